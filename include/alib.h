@@ -28,6 +28,15 @@
  */
 inline time_t sNow();
 
+/**
+ * @brief Rebuild a block read back from a file
+ *
+ * Same as newBlock but time and crc are given, @p packs is consumed
+ * the same way: the array must come from memAlloc(MEM_PARSER, ...) and
+ * the packs from newPack.
+ * @return NULL - a pack could not be added or malloc failed, logged\n
+ * ptr to the block
+ */
 block *restore_block(uint32_t     time,
                          uint32_t crc,
                          uint16_t n_pack,
@@ -64,7 +73,7 @@ void printBlock(block *target //!< The block to be printed
 pack *newPack(char         *dn, //!< Display name
                   uint64_t  xl, //!< Exact length (size in bytez)
                   char     *xt, //!< exact topic (URN with hash of file)
-                  char *tr      //!< tracker url
+                  uint32_t  tr  //!< tracker url, id from the chain's trackers
                   );
 
 tran *newTran();
@@ -72,6 +81,15 @@ tran *newTran();
 /**
  * @brief Create a new block
  * 
+ * Thin wrapper over BlockBuilder (see blockbuilder.h): @p packs and
+ * every pack in it (as made by newPack) are copied into the block's
+ * arena and freed, the caller must not use them afterwards. The array
+ * is freed with memFree(MEM_PARSER, ...): allocate it with memAlloc or
+ * memRealloc on MEM_PARSER, never plain malloc, or the memstat counters
+ * go wrong. A pack that can't be added (see BlockBuilder::add) fails
+ * the whole block rather than being dropped.
+ * @return NULL - a pack could not be added or malloc failed, logged\n
+ * ptr to the block
  */
 block *newBlock(uint32_t n,
                     uint64_t key,
@@ -79,16 +97,215 @@ block *newBlock(uint32_t n,
                     pack **packs
                     );
 
+/**
+ * @brief Get the columnar layout of a block's packs, building it from
+ * bx->packs the first time
+ *
+ * Arena blocks get the columns in their arena, heap blocks get one
+ * malloc'd region freed by deleteBlock.
+ * @return NULL - malloc failed or the block has no packs\n
+ * ptr to the columns, owned by the block
+ */
+blockCols *blockColumns(block *bx //!< Block to get the columns of
+                        );
+
+/**
+ * @brief Get the pack array of a block, decoding it on first use for
+ * blocks loaded header only (block::src)
+ *
+ * Safe to call from several threads: each one racing on the first use
+ * decodes its own copy, the first to publish it with a compare and
+ * swap wins and the others free theirs.
+ * @return NULL - columnar only block, or the decoding failed\n
+ * the pack array, owned by the block
+ */
+pack **blockPacks(block *bx //!< Block holding the packs
+                  );
+
+/**
+ * @brief Get pack @p i of a block, works for columnar only blocks too
+ *
+ * Compatibility accessor for pack* callers. A block loaded header only
+ * gets its packs through blockPacks. A block made by blockCompact has
+ * no pack array, the first call builds pack views into its string heap
+ * (no strings are copied). Not thread safe for the first call on a
+ * columnar only block.
+ * @return NULL - bad index or malloc failed\n
+ * ptr to the pack, owned by the block
+ */
+pack *blockPack(block *bx, //!< Block holding the pack
+                uint16_t i //!< Index of the pack
+                );
+
+/**
+ * @brief Replace a block by a columnar only copy of it
+ *
+ * The copy holds the header and the columns in a single arena, @p bx
+ * is deleted on success.
+ * @return NULL - malloc failed, @p bx is untouched\n
+ * ptr to the new block
+ */
+block *blockCompact(block *bx //!< Block to convert
+                    );
+
 chain *newChain(void);
 
 //! return 1 on success
+/**
+ * Appends at the next free block number, safe to call from several
+ * threads (chainReserve + chainPublish).
+ */
 bool insertBlock(block *bx,
                      chain *ch
                      );
 
+/**
+ * @brief Reserve @p count consecutive block numbers
+ *
+ * Every reserved number must be published with chainPublish, or given
+ * up with chainAbandon, the visible size of the chain stops at the
+ * first unpublished one.
+ * @return MAX_U32 - malloc failed or the chain is full\n
+ * first reserved block number
+ */
+uint32_t chainReserve(chain *ch, //!< Chain to append to
+                      uint32_t count //!< Number of blocks to reserve
+                      );
+
+/**
+ * @brief Publish a block at a number from chainReserve
+ *
+ * Lock free. Once every number below @p i is published too, the block
+ * becomes visible through chainSize. A block whose crc is 0, a new one,
+ * gets its blockCrc here, loaded blocks keep theirs for chainVerify.
+ * @return 0 - @p bx is NULL, nothing is published, see chainAbandon\n
+ * 1 - success
+ */
+bool chainPublish(chain *ch, //!< Chain to append to
+                  uint32_t i, //!< Reserved block number
+                  block *bx //!< Block, owned by the chain afterwards
+                  );
+
+/**
+ * @brief Give up a reserved number whose block could not be made
+ *
+ * Publishes an empty block (no packs, key 0) numbered @p i in its
+ * place, so the blocks reserved after it still become visible and
+ * every block below chainSize stays a valid one.
+ * @return 0 - malloc failed, the chain stops short of @p i\n
+ * 1 - success
+ */
+bool chainAbandon(chain *ch, //!< Chain the number is from
+                  uint32_t i //!< Reserved block number
+                  );
+
+/**
+ * @brief Move every block of @p from to the end of @p ch
+ *
+ * Tracker ids are translated to @p ch's table, the crcs stay valid
+ * since they hash the urls. @p from is left empty, free it with
+ * deleteChain. Nothing may be appending to @p from.
+ * @return 0 - malloc failed or @p ch is full, nothing was moved, or
+ * the packs of a lazy block failed to decode: the blocks before it
+ * are moved, its number and the ones after are given up with
+ * chainAbandon and it and the rest stay in @p from\n
+ * 1 - success
+ */
+bool chainAppend(chain *ch, //!< Destination
+                 chain *from //!< Chain giving up its blocks
+                 );
+
+/**
+ * @brief Number of blocks readers can use, safe while producers append
+ *
+ * Every block below the returned value is published and stays valid,
+ * reading them takes no lock.
+ */
+static inline uint32_t chainSize(const chain *ch)
+{
+    return __atomic_load_n(&ch->size, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Get block number @p i of the chain, no bounds checking
+ */
+static inline block *chainBlock(const chain *ch, //!< Chain to index
+                                uint32_t i //!< Index, less than chainSize
+                                )
+{
+    block ***seg = __atomic_load_n(&ch->seg, __ATOMIC_ACQUIRE);
+    return seg[i >> CHAIN_SEG_SHIFT][i & CHAIN_SEG_MASK];
+}
+
+/**
+ * @brief Get the contiguous run of blocks starting at @p start
+ *
+ * The run stops at @p end or at the end of the segment holding
+ * @p start, whichever comes first. Loop with start += *len to walk a
+ * range [start, end) without copying the directory.
+ * @return ptr to chainBlock(ch, start), @p len holds the run length
+ */
+static inline block **chainSpan(const chain *ch, //!< Chain to walk
+                                uint32_t start, //!< First index
+                                uint32_t end, //!< One past the last index
+                                uint32_t *len //!< Out: length of the run
+                                )
+{
+    block ***seg = __atomic_load_n(&ch->seg, __ATOMIC_ACQUIRE);
+    uint32_t left = CHAIN_SEG_SIZE - (start & CHAIN_SEG_MASK);
+    *len = end - start < left ? end - start : left;
+    return &seg[start >> CHAIN_SEG_SHIFT][start & CHAIN_SEG_MASK];
+}
+
+#define VERIFY_THREADS 4 //!< threads the loaders check crcs on
+
+/**
+ * @brief CRC32C of the canonical bytes of a block
+ *
+ * Little endian, the crc field and the tracker ids are left out, the
+ * tracker urls are hashed instead so the crc survives id remapping:
+ *
+ *     u32 n, u32 time, u16 nPack, u16 nTran, u64 key
+ *     per pack: u16 dnLen, dn, u64 xl, u16 urlLen, url, u8 xtType,
+ *               then 20 digest bytes or u16 len, topic for XT_STR
+ *     per tran: u32 time, u32 id, u64 src, u64 dest, u64 amount, u64 key
+ */
+uint32_t blockCrc(block *bx, //!< Block to hash
+                  const strtab *trackers //!< Table of its tracker ids
+                  );
+
+/**
+ * @brief Check the crc of blocks [@p start, @p end) with @p threads
+ * workers, the calling thread and tasks of the thread pool (pool.h)
+ *
+ * @return Number of blocks whose crc does not match, each one is logged
+ */
+uint32_t chainVerify(chain *ch, //!< Chain to check
+                     uint32_t start, //!< First block
+                     uint32_t end, //!< One past the last block
+                     uint8_t threads //!< Threads to use, at least 1
+                     );
+
 uint32_t deletePack(pack *target
 );
 
+/**
+ * @brief Free a block, its packs and trans, and the block itself
+ *
+ * @return Number of bytes released
+ */
+uint32_t deleteBlock(block *target
+);
+
+/**
+ * @brief Convert every block of the chain with blockCompact
+ *
+ * @return 0 - malloc failed, the chain is partly converted but valid\n
+ * 1 - success
+ */
+bool chainColumnize(chain *ch //!< Chain to convert
+                    );
+
 uint32_t deleteChain(chain *target
 );
 
@@ -7,20 +7,106 @@
 
 #include "atype.h"
 
+#define PART_PIPE_DEPTH 4 //!< chunks serialized ahead of the encoder
+
 /**
- * @brief Extract a chain from a text file(s)
- *
- * Currently doesnt support decompression, not that much effort to
- * add that in though.
+ * @brief Extract a chain from the parts written by chainCompactor
  *
- * This function will take a string argument that will be the base for
- * the files, i.e temp\%d.file, it will substitute parts in to make
- * temp1.file, temp2.file etc... Should improve this in the future.
+ * Every part is loaded by a task of the thread pool (pool.h), a .7z
+ * part with lzmaFile2Chain, into a chain of its own. The parts are then
+ * ordered by the n of their first block and appended, their blocks must
+ * follow each other with no gap or overlap. Once loaded every block is
+ * checked against its crc (chainVerify).
+ * @return NULL - a part is missing or corrupt, the blocks have a gap or
+ * an overlap, or malloc failed, it is logged\n
+ * ptr to the chain
  */
-chain *chain_extractor(const char *inFile, //!< String to filename (not working rn)
-                       uint8_t parts //!< Number of files
+chain *chain_extractor(const char *inFile, /**< Name of the parts with one
+                                              \%u for the part number,
+                                              from 1, i.e temp\%u.file.7z.
+                                              NULL for the names
+                                              chainCompactor writes */
+                       uint8_t parts, //!< Number of files
+                       uint8_t fmt = CHAIN_TEXT //!< ChainFormat of the files
                        );
 
+/**
+ * @brief Append the blocks of a part compressed as a whole, the .7z
+ * chainCompactor writes, to @p ch
+ *
+ * The part is decoded on a thread of its own and handed to the
+ * incremental parser of its format (textStream, binStream) buffer by
+ * buffer, so decoding and parsing overlap and only a few buffers of
+ * decoded data are held at a time. Nothing is written to disk.
+ * @return 0 - the part is corrupt, framed or truncated, or malloc
+ * failed\n
+ * 1 - success
+ */
+bool lzmaFile2Chain(FILE *fp, //!< Part to read, opened "rb"
+                    chain *ch, //!< Destination, must be a valid pointer
+                    uint8_t fmt = CHAIN_TEXT //!< ChainFormat of the part
+                    );
+
+/**
+ * @brief Name of the file holding part @p part in format @p fmt
+ *
+ * temp\%u.file for text, temp\%u.bin for binary, temp\%u.tcf for
+ * framed.
+ * @return Same as snprintf
+ */
+uint32_t partName(char *buf, //!< Destination
+                  uint32_t len, //!< Size of buf
+                  uint32_t part, //!< Part number, from 1
+                  uint8_t fmt //!< ChainFormat
+                  );
+
+/**
+ * @brief Print the Ctime/Csize/Cdict lines that start a text part
+ */
+void partHeadText(chain *ch, //!< Chain being written
+                  uint32_t end, //!< Printed as Csize
+                  uint32_t part, //!< Part number, printed as Ctime
+                  outBuf *ob //!< Destination
+                  );
+
+/**
+ * @brief Compress blocks [@p start, @p end) as one part without an
+ * intermediate file
+ *
+ * Serializing and encoding overlap: tasks of the thread pool serialize
+ * the blocks into a ring of @p depth fixed size chunks while the
+ * encoder reads the oldest one through an ISeqInStream, so at most
+ * @p depth chunks of the part are in memory. When the ring is empty and
+ * no serializer runs the encoder serializes the next chunk itself. The
+ * size is not known up front so the .7z ends with an end marker, see
+ * compress_stream.
+ * @return 0 - a write, malloc or the encoder failed\n
+ * 1 - success
+ */
+bool partToLzma(chain *ch, //!< Chain to write
+                uint32_t start, //!< First block
+                uint32_t end, //!< One past the last block
+                uint32_t part, //!< Part number
+                uint8_t fmt, //!< ChainFormat of the part
+                FILE *fp, //!< Destination .7z, opened "wb"
+                uint8_t depth = PART_PIPE_DEPTH, //!< Chunks in the ring
+                partStat *stat = NULL /**< Gets the stage counters, raw
+                                         to full, may be NULL */
+                );
+
+/**
+ * @brief Write blocks [@p start, @p end) of a chain as one text part
+ *
+ * @return 0 - a write or malloc failed\n
+ * 1 - success
+ */
+bool partToText(chain *ch, //!< Chain to write
+                uint32_t start, //!< First block
+                uint32_t end, //!< One past the last block
+                uint32_t part, //!< Part number, printed as Ctime
+                FILE *fp //!< Destination
+                );
+
 /**
  * @brief Convert chain to single file without compressing
  *
@@ -33,6 +119,9 @@ void *chainToText_to_file(chain *ch, //!< chain to be printed
 
 /**
  * @brief Read from a file and convert to a chain struct
+ *
+ * Line by line with fgets, kept to compare against textFile2Chain
+ * (textparse.h) which chain_extractor uses.
  */
 int text2Chainz(FILE *fp, //!< FP to the file to read in
                 chain *ch /**< Destination of the chain, must be a
@@ -56,13 +145,29 @@ char *indexes_of(char       *haystack, //!< The string to search through
                  );
 
 /**
- * @brief compact the entire chain into x parts, using x threads
+ * @brief compact the entire chain into x parts, one task of the
+ * thread pool (pool.h) per part
  * 
+ * The parts are cut on the estimated serialized size of the blocks
+ * rather than their count, blocks differ a lot in packs and name
+ * lengths. The cut only depends on the chain, the same chain always
+ * gives the same part files. Without @p stat the blocks, bytes and
+ * time of every part are printed, the slowest part sets the wall time,
+ * with the throughput of its serialize and encode stages (see
+ * partToLzma). With it they are only returned there.
+ * @return 0 - a part could not be created or written in full, it is
+ * logged\n
+ * 1 - success
  */
 bool chainCompactor(chain *ch, //!< Chain to be compacted
-                    uint8_t parts = 1 /**< Number of threads to use 
+                    uint8_t parts = 1, /**< Number of tasks to use 
                                          also the number of files to
                                          split the info into */
+                    uint8_t fmt = CHAIN_TEXT, //!< ChainFormat of the parts
+                    partStat *stat = NULL, /**< @p parts entries filled
+                                              with what every part cost,
+                                              may be NULL */
+                    uint8_t depth = PART_PIPE_DEPTH //!< See partToLzma
                     );
 
 /**
@@ -101,6 +206,30 @@ void packToText(pack *pk, //!< Struct pack to be printed
                 int len //!< Length of buffer
                 );
 
+/**
+ * @brief Print a block like blockToText, into a buffered writer
+ *
+ * Same bytes as blockToText without going through snprintf, used by
+ * partToText.
+ */
+void blockToBuf(block *bx, //!< The block to be printed
+                outBuf *ob //!< Destination
+                );
+
+/**
+ * @brief Print a tran like tranToText, into a buffered writer
+ */
+void tranToBuf(tran *tx, //!< Struct tran to be printed
+               outBuf *ob //!< Destination
+               );
+
+/**
+ * @brief Print a pack like packToText, into a buffered writer
+ */
+void packToBuf(pack *pk, //!< Struct pack to be printed
+               outBuf *ob //!< Destination
+               );
+
 /**
  * @brief A thread start routine
  *
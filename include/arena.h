@@ -0,0 +1,72 @@
+/**
+ * @file arena.h
+ * @brief Bump allocator used to give each block a single owner for
+ * its packs and strings
+ *
+ * Allocations are never freed one by one, the whole arena is released
+ * in one go. Chunks are never moved so pointers stay valid until then.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include "atype.h"
+#include "memstat.h"
+
+/** @brief Smallest chunk the arena will ask malloc for */
+#define ARENA_CHUNK 4096
+
+/** @brief Alignment of every allocation handed out */
+#define ARENA_ALIGN 8
+
+/**
+ * @brief Set an arena to the empty state, does not allocate
+ */
+void arenaInit(arena *ar, //!< Arena to initialize
+               uint8_t sub = MEM_BLOCK //!< MemSub to charge the chunks to
+               );
+
+/**
+ * @brief Make sure the arena can hand out @p size bytes without
+ * another malloc
+ *
+ * Use this with an estimate of the final size before filling the
+ * arena so building it stays at one allocation.
+ * @return 0 - malloc failed\n
+ * 1 - success
+ */
+bool arenaReserve(arena *ar, //!< Arena to grow
+                  uint32_t size //!< Bytes that will be needed
+                  );
+
+/**
+ * @brief Allocate @p size bytes, aligned to ARENA_ALIGN
+ *
+ * @return NULL - malloc failed\n
+ * ptr to the memory, owned by the arena
+ */
+void *arenaAlloc(arena *ar, //!< Arena to allocate from
+                 uint32_t size //!< Number of bytes
+                 );
+
+/**
+ * @brief Copy @p len chars of @p str into the arena and null terminate
+ *
+ * @return NULL - malloc failed\n
+ * ptr to the copy, owned by the arena
+ */
+char *arenaStrndup(arena *ar, //!< Arena to copy into
+                   const char *str, //!< String to copy
+                   uint32_t len //!< Length of str without the terminator
+                   );
+
+/**
+ * @brief Free every chunk of the arena and reset it
+ *
+ * Anything allocated from the arena (including the arena itself if it
+ * lives in one of its chunks) is invalid after this call.
+ * @return Number of bytes released
+ */
+uint32_t arenaRelease(arena *ar //!< Arena to release
+                      );
+
+#endif//_ARENA_H
@@ -11,6 +11,8 @@
 
                      //#include <boost/cstdint.hpp>
 #include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
 
 #define LOG 0                   //!< not sure
 
@@ -19,6 +21,8 @@
 #define MAX_U16  65535U         //!< max size of a 16 bit int
 #define MAX_U32  4294967295UL   //!< maz size of a 32 bit int
 
+#define PACK_STR_MAX MAX_U16    //!< longest dn or XT_STR topic, stored as u16
+
 /*
  * typedef unsigned char     uint8_t;
  * typedef unsigned short    uint16_t;
@@ -37,18 +41,90 @@ enum Link
     MLEN             //!< number of total parameters, must be last
 };
 
+/**
+ * @brief How the exact topic of a pack is stored
+ */
+enum XtType
+{
+    XT_STR = 0,      //!< unknown URN, kept as a string
+    XT_BTIH_HEX,     //!< urn:btih: with 40 hex chars
+    XT_BTIH_B32      //!< urn:btih: with 32 base32 chars
+};
+
+/**
+ * @brief Binary BitTorrent infohash (sha1 digest)
+ */
+typedef struct
+{
+    uint8_t b[20];   //!< raw digest bytes
+}infohash;
+
 /**
  * @brief Holds information about the parameters of the magnet link
  */
 typedef struct
 {
     char info[6];    //!< first 5 characters of name, null terminated
+    uint8_t xtType;  //!< how xt is stored, see XtType
+    uint32_t tr;     //!< address tracker, id in the chain's tracker table
     char *dn;        //!< display name, filename
     uint64_t xl;     //!< exact length, size of file in bytez
-    char *xt;        //!< exact topic, URN with hash of file
-    char *tr;        //!< address tracker, tracker url
+    union {
+        infohash hash; //!< digest of urn:btih, xtType != XT_STR
+        char *str;     //!< any other URN, xtType == XT_STR
+    }xt;             //!< exact topic, URN with hash of file
 }pack;
 
+/**
+ * @brief One chunk of a bump arena, the usable bytes follow the header
+ */
+typedef struct arenaChunk
+{
+    struct arenaChunk *next; //!< previously filled chunk, NULL for the first
+    uint32_t cap;            //!< usable bytes after the header
+    uint32_t used;           //!< bytes already handed out
+}arenaChunk;
+
+/**
+ * @brief Bump allocator, everything in it is released at once
+ */
+typedef struct
+{
+    arenaChunk *head;        //!< chunk currently being filled
+    uint32_t    bytes;       //!< total bytes reserved from malloc
+    uint8_t     sub;         //!< MemSub the chunks are charged to
+}arena;
+
+/**
+ * @brief One interned string, see strtab
+ */
+typedef struct
+{
+    const char *str; //!< null terminated, owned by the table's arena
+    uint32_t len;    //!< strlen of str
+    uint32_t hash;   //!< hash of str, kept for rehashing
+}strtabEntry;
+
+/**
+ * @brief Table of interned strings, each distinct string is stored once
+ * and referred to by a 32 bit id
+ *
+ * Interning takes the table's lock, lookups by id don't: ent is never
+ * resized in place, old arrays are kept in retired until strtabFree.
+ */
+typedef struct
+{
+    strtabEntry *ent; //!< id -> string
+    uint32_t n;       //!< number of strings, ids are 0 to n - 1
+    uint32_t cap;     //!< capacity of ent
+    uint32_t *slot;   //!< open addressing hash of id + 1, 0 is empty
+    uint32_t nSlot;   //!< number of slots, power of two
+    arena mem;        //!< string bytes
+    strtabEntry **retired; //!< previous ent arrays, still readable
+    uint32_t nRetired;//!< number of retired arrays
+    pthread_mutex_t lock; //!< serializes strtabIntern
+}strtab;
+
 /**
  * @brief Holds information about a transaction
  */
@@ -62,6 +138,42 @@ typedef struct
     uint64_t key;
 }tran;
 
+/**
+ * @brief Struct of arrays layout of the packs of a block
+ *
+ * One entry per pack in every array so scans over a single field are
+ * sequential. The display names, then the XT_STR topics, are stored
+ * null terminated back to back in heap.
+ */
+typedef struct
+{
+    uint16_t  n;        //!< number of packs
+    uint32_t  heapLen;  //!< bytes used in heap
+    uint64_t *xl;       //!< exact lengths
+    uint32_t *tr;       //!< tracker ids
+    uint32_t *dnOff;    //!< n + 1 offsets of the display names in heap
+    uint32_t *xtOff;    //!< n + 1 offsets of the topics, empty for btih
+    infohash *hash;     //!< btih digests, zero for XT_STR topics
+    char    (*info)[6]; //!< info of every pack
+    uint8_t  *xtType;   //!< XtType of every pack
+    char     *heap;     //!< string bytes
+}blockCols;
+
+/**
+ * @brief Where the packs of a block loaded header only come from
+ *
+ * The owner of the data, i.e. a chainView, keeps it and the source
+ * alive as long as the blocks, blockPacks calls load on first use.
+ */
+typedef struct
+{
+    /** Decode @p nPack packs at @p at into one MEM_BLOCK allocation
+     * holding the pack array, the packs and their strings, NULL on
+     * failure */
+    pack **(*load)(const void *ctx, const uint8_t *at, uint16_t nPack);
+    const void *ctx; //!< passed back to load
+}blockSrc;
+
 /**
  * @brief Holds information about a block
  */
@@ -73,28 +185,97 @@ typedef struct
     uint16_t nTran; //!< number of transactions
     uint32_t n;     //!< block number
     uint64_t key;   //!< gen next
-    pack **packs;   //!< variable size
+    pack **packs;   //!< variable size, NULL until needed for columnar blocks
     tran **trans;
+    blockCols *cols;//!< columnar copy of the packs, NULL if not built
+    arena mem;      //!< owns the block, packs and strings, empty for heap blocks
+    const blockSrc *src; //!< set if packs are decoded on first use, see blockPacks
+    const uint8_t *lazy; //!< where src finds the packs
 }block;
 
+#define CHAIN_SEG_SHIFT 12                        //!< log2 of blocks per segment
+#define CHAIN_SEG_SIZE  (1U << CHAIN_SEG_SHIFT)   //!< blocks per segment
+#define CHAIN_SEG_MASK  (CHAIN_SEG_SIZE - 1)      //!< index inside a segment
+
 /**
  * @brief The blockchain structure
+ *
+ * Blocks are kept in fixed size segments of CHAIN_SEG_SIZE pointers,
+ * only the small top level table is ever reallocated so appending is
+ * amortized O(1) and segments never move. A grown table replaces the
+ * old one, which is kept in retired so lock free readers holding it
+ * stay valid.
+ *
+ * Producers reserve block numbers with chainReserve and publish blocks
+ * in any order, size only covers the prefix where every block has been
+ * published.
  */
 typedef struct
 {
     uint32_t time;  //!< time of last update
-    uint32_t size;  //!< Number of blocks, 4 bil max
-    block **head;   //!< expandable, dynamic array of blocks
+    uint32_t size;  //!< Number of blocks, 4 bil max, published prefix
+    uint32_t reserved; //!< block numbers handed out, size <= reserved
+    block ***seg;   //!< top level table of segments
+    uint32_t nSeg;  //!< number of segments allocated
+    uint32_t capSeg;//!< capacity of the top level table
+    block ****retired; //!< previous top level tables
+    uint32_t nRetired; //!< number of retired tables
+    pthread_mutex_t lock; //!< serializes reservations and growth
+    strtab trackers;//!< tracker urls referred to by pack::tr
 }chain;
 
+/**
+ * @brief On disk formats of a chain part
+ */
+enum ChainFormat
+{
+    CHAIN_TEXT = 0,  //!< {B/{P tab indented text, temp%u.file
+    CHAIN_BIN,       //!< little endian binary, temp%u.bin, see chainbin.h
+    CHAIN_FRAME      //!< binary in LZMA frames, temp%u.tcf, see chainframe.h
+};
+
+/**
+ * @brief Buffered output to a file, see outbuf.h
+ */
+typedef struct
+{
+    char    *buf;    //!< pending bytes
+    uint32_t len;    //!< bytes in buf
+    uint32_t cap;    //!< size of buf
+    FILE    *fp;     //!< destination
+    bool     err;    //!< a write or malloc failed, later writes are dropped
+}outBuf;
+
+/**
+ * @brief What one part of chainCompactor cost
+ */
+typedef struct
+{
+    uint32_t start;   //!< first block of the part
+    uint32_t end;     //!< one past its last block
+    uint64_t est;     //!< serialized bytes the cut was made on
+    uint64_t bytes;   //!< bytes written to the part file
+    uint32_t ms;      //!< wall time of the part's task
+    // stages of partToLzma, zero for framed parts
+    uint64_t raw;     //!< serialized bytes handed to the encoder
+    uint64_t serUs;   //!< time spent serializing, on any thread
+    uint64_t encUs;   //!< time the encoding thread spent encoding
+    uint64_t waitUs;  //!< time the encoder waited for a chunk
+    uint32_t full;    //!< times serializing stopped on a full queue
+}partStat;
+
 /**
  * @brief Struct holding values for pthread fn call
  */
 typedef struct{
     uint32_t   i;               //!<  current block num
-    block    **head;            //!<  head of the block chain
+    chain     *ch;              //!<  the block chain
     uint32_t   start;           //!<  starting block num 
     uint32_t   end;             //!<  ending block num 
+    uint8_t    fmt;             //!<  ChainFormat of the part
+    partStat  *stat;            //!<  bytes and time of the part, may be NULL
+    uint8_t    depth;           //!<  chunks queued for the encoder
+    bool       ok;              //!<  set by the task, 0 if the part is missing or short
 }threadParams;
 
 #endif//_ATYPE_H
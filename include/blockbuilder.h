@@ -0,0 +1,135 @@
+/**
+ * @file blockbuilder.h
+ * @brief Move-only C++ builder for arena blocks and a read view of packs
+ *
+ * BlockBuilder owns the block being built until finish() hands it
+ * over, if the builder goes out of scope first the block is released.
+ * Strings are taken as std::string_view, their lengths are known up
+ * front and the bytes are copied once, straight into the block's arena.
+ */
+#ifndef _BLOCKBUILDER_H
+#define _BLOCKBUILDER_H
+
+#include <string_view>
+
+#include "atype.h"
+
+/**
+ * @brief Read only view of a pack, nothing is copied
+ */
+class PackView
+{
+public:
+    explicit PackView(const pack *pk //!< Pack to look at, must outlive the view
+                      ) : pk(pk) {}
+
+    std::string_view dn() const { return pk->dn ? pk->dn : ""; }
+    std::string_view info() const { return pk->info; }
+    uint64_t xl() const { return pk->xl; }
+    uint32_t tr() const { return pk->tr; }
+    uint8_t xtType() const { return pk->xtType; }
+
+    //! Digest of a btih topic, NULL for XT_STR topics
+    const infohash *hash() const
+    {
+        return pk->xtType != XT_STR ? &pk->xt.hash : NULL;
+    }
+
+    //! Topic string, empty for btih topics (see xtFormat)
+    std::string_view xtStr() const
+    {
+        return pk->xtType == XT_STR && pk->xt.str ? pk->xt.str : "";
+    }
+
+    const pack *get() const { return pk; }
+
+private:
+    const pack *pk;
+};
+
+/**
+ * @brief Builds a block whose header, pack array, packs and strings all
+ * live in the block's own arena
+ */
+class BlockBuilder
+{
+public:
+    /**
+     * @brief Start a block, time is set to now and crc to 0
+     *
+     * Check ok() before use, a failed allocation leaves the builder empty.
+     */
+    BlockBuilder(uint32_t n, //!< Block number
+                 uint64_t key, //!< Gen next
+                 uint16_t nPack, //!< Expected number of packs, can be exceeded
+                 uint32_t strBytes = 0 /**< Estimate of the bytes needed
+                                          for all the strings, with
+                                          terminators */
+                 );
+    ~BlockBuilder();
+
+    BlockBuilder(BlockBuilder &&o) noexcept;
+    BlockBuilder &operator=(BlockBuilder &&o) noexcept;
+    BlockBuilder(const BlockBuilder &) = delete;
+    BlockBuilder &operator=(const BlockBuilder &) = delete;
+
+    //! 1 if the builder holds a block
+    bool ok() const { return bx != NULL; }
+
+    //! Number of packs added so far
+    uint16_t size() const { return bx ? bx->nPack : 0; }
+
+    /**
+     * @brief Append a pack, the topic is parsed with xtParse
+     *
+     * @return NULL - a string over PACK_STR_MAX, MAX_U16 packs already
+     * or malloc failed\n
+     * ptr to the new pack, owned by the block
+     */
+    pack *add(std::string_view dn, //!< Display name
+              uint64_t xl, //!< Exact length (size in bytez)
+              std::string_view xt, //!< Exact topic (URN with hash of file)
+              uint32_t tr //!< Tracker id from the chain's trackers
+              );
+
+    /**
+     * @brief Append a pack whose btih topic is already a digest
+     *
+     * Used by the binary loaders, nothing is parsed.
+     */
+    pack *add(std::string_view dn, //!< Display name
+              uint64_t xl, //!< Exact length (size in bytez)
+              uint8_t xtType, //!< XT_BTIH_HEX or XT_BTIH_B32
+              const infohash &hash, //!< Digest of the topic
+              uint32_t tr //!< Tracker id from the chain's trackers
+              );
+
+    /**
+     * @brief Append a copy of an existing pack, the topic is copied as
+     * is without going through text
+     */
+    pack *add(const PackView &pv //!< Pack to copy
+              );
+
+    void setN(uint32_t n) { if (bx) bx->n = n; }
+    void setTime(uint32_t time) { if (bx) bx->time = time; }
+    void setCrc(uint32_t crc) { if (bx) bx->crc = crc; }
+    void setKey(uint64_t key) { if (bx) bx->key = key; }
+
+    /**
+     * @brief Hand the block over, the builder is empty afterwards
+     *
+     * @return NULL - the builder was empty\n
+     * ptr to the block, free it with deleteBlock
+     */
+    block *finish();
+
+private:
+    pack *newPackSlot(std::string_view dn);
+    void release();
+
+    block *bx;    //!< block being built, lives in its own arena
+    uint16_t cap; //!< room in bx->packs
+};
+
+#endif//_BLOCKBUILDER_H
@@ -0,0 +1,382 @@
+/**
+ * @file chainbin.h
+ * @brief Binary format of a chain part, the compact alternative to the
+ * {B/{P text written by alibio
+ *
+ * Every integer is little endian, strings are length prefixed and not
+ * null terminated. A part is:
+ *
+ *     header   magic "TCHB", u16 version, u16 flags (0), u32 part,
+ *              u32 nBlock, u32 nDict
+ *     dict     nDict times: u16 len, url bytes, the index is the id
+ *     blocks   nBlock times:
+ *              var zigzag(n - previous n - 1), var zigzag(time -
+ *              previous time), var nPack, var nTran, u32 crc, var key,
+ *              var body bytes
+ *              nPack times: u16 dnLen, dn bytes, u64 xl, u32 tr,
+ *                           u8 xtType, then 20 digest bytes for btih
+ *                           topics or u16 len, bytes for XT_STR ones
+ *              nTran times: u32 time, u32 id, u64 src, u64 dest,
+ *                           u64 amount, u64 key
+ *
+ * var is a LEB128 varint. Block headers are delta coded against the
+ * previous block of the same run, a run starts from binBlockStart: the
+ * whole part, or one frame of a framed part. The body size lets header
+ * only scans jump from header to header (binBlockSkip).
+ *
+ * pack::tr holds an id of the part's dict, STRTAB_NONE if unknown.
+ * Trans are written but, like the text loader, not read back.
+ */
+#ifndef _CHAINBIN_H
+#define _CHAINBIN_H
+
+#include <stddef.h>
+#include <string.h>
+#include <string_view>
+
+#include "atype.h"
+
+#define CHAIN_BIN_MAGIC   "TCHB" //!< first 4 bytes of a binary part
+#define CHAIN_BIN_VERSION 3      //!< bumped on any layout change
+#define CHAIN_BIN_HEADER  20     //!< bytes in the part header
+#define CHAIN_BIN_BLOCK   10     //!< fewest bytes in a block header
+#define CHAIN_BIN_BLOCK_MAX 35   //!< most bytes in a block header
+#define CHAIN_BIN_TRAN    40     //!< bytes in a tran
+
+/**
+ * @brief Read position in a binary part, see binHave before any get
+ */
+typedef struct
+{
+    const uint8_t *p;   //!< next byte
+    const uint8_t *end; //!< one past the last byte
+}binCursor;
+
+/**
+ * @brief Part header as stored
+ */
+typedef struct
+{
+    uint32_t part;   //!< part number
+    uint32_t nBlock; //!< blocks in the part
+    uint32_t nDict;  //!< urls in the dict
+}binPart;
+
+/**
+ * @brief Decoded block header, the packs follow it
+ *
+ * Also the state of a run: the readers and blockToBin take the header
+ * of the previous block and leave the new one in its place.
+ */
+typedef struct
+{
+    uint32_t time;
+    uint32_t crc;
+    uint16_t nPack;
+    uint16_t nTran;
+    uint32_t n;
+    uint64_t key;
+    uint32_t body; //!< bytes of packs and trans
+}binBlock;
+
+/**
+ * @brief One stored pack, every pointer points into the part's data
+ */
+typedef struct
+{
+    std::string_view dn;    //!< display name, not null terminated
+    uint64_t xl;            //!< exact length
+    uint32_t tr;            //!< id in the part's dict
+    uint8_t xtType;         //!< XtType
+    const uint8_t *hash;    //!< 20 digest bytes, NULL for XT_STR
+    std::string_view xtStr; //!< topic of XT_STR packs, empty otherwise
+}binPack;
+
+/**
+ * @brief Incremental reader for a binary part that arrives in pieces,
+ * set it up with binStreamInit
+ *
+ * Errors are sticky, every later call fails once one did.
+ */
+typedef struct
+{
+    outBuf    in;   //!< bytes not read yet, start on a block
+    binPart   head; //!< part header, valid once map is read
+    binBlock  h;    //!< header of the last block built
+    uint32_t *map;  //!< dict id -> tracker id, NULL until the dict is in
+    bool      dict; //!< the header and dict were read
+    uint32_t  done; //!< blocks built
+    bool      ok;   //!< 0 once something failed
+}binStream;
+
+//! 1 if @p len more bytes can be read
+static inline bool binHave(const binCursor *c, size_t len)
+{
+    return (size_t)(c->end - c->p) >= len;
+}
+
+static inline uint16_t binGet16(binCursor *c)
+{
+    uint16_t v = c->p[0] | (uint16_t)c->p[1] << 8;
+    c->p += 2;
+    return v;
+}
+
+static inline uint32_t binGet32(binCursor *c)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)c->p[i] << (8 * i);
+    c->p += 4;
+    return v;
+}
+
+static inline uint64_t binGet64(binCursor *c)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v |= (uint64_t)c->p[i] << (8 * i);
+    c->p += 8;
+    return v;
+}
+
+/**
+ * @brief Read a varint checked earlier, at most 10 bytes
+ */
+static inline uint64_t binGetVar(binCursor *c)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 70; shift += 7) {
+        uint8_t b = *c->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80)
+            break;
+    }
+    return v;
+}
+
+/**
+ * @brief Read a varint, 0 if it runs past the end or over 10 bytes
+ */
+static inline bool binVar(binCursor *c, uint64_t *v)
+{
+    const uint8_t *p = c->p;
+    *v = 0;
+    for (int shift = 0; p < c->end && shift < 70; shift += 7) {
+        uint8_t b = *p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) {
+            c->p = p;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//! Map a signed delta to an unsigned varint, small magnitudes first
+static inline uint32_t binZigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t binUnzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+//! State before the first block of a run, see binBlock
+static inline void binBlockStart(binBlock *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->n = MAX_U32; // the first block is expected to be 0
+}
+
+/**
+ * @brief Read and check the part header, @p c is left on the dict
+ *
+ * @return 0 - too short, bad magic or unsupported version\n
+ * 1 - success
+ */
+bool binPartHeader(binCursor *c, //!< Cursor at the start of the part
+                   binPart *h //!< Out: the header
+                   );
+
+/**
+ * @brief Read the next dict url
+ *
+ * @return 0 - truncated\n
+ * 1 - success
+ */
+bool binDictEntry(binCursor *c, //!< Cursor on a dict entry
+                  std::string_view *url //!< Out: the url, points into the data
+                  );
+
+/**
+ * @brief Read a block header and check the whole block
+ *
+ * On success @p packs is left on the first pack and @p c after the
+ * block. Every pack of the block can then be read with binPackGet
+ * without bounds checks.
+ * @return 0 - truncated or corrupt\n
+ * 1 - success
+ */
+bool binBlockHeader(binCursor *c, //!< Cursor on a block
+                    binBlock *h, //!< In: previous header, out: this one
+                    binCursor *packs, //!< Out: cursor on the first pack
+                    uint32_t *strBytes //!< Out: bytes the strings take with terminators
+                    );
+
+/**
+ * @brief Read a block header and jump over the body, nothing in the
+ * body is looked at
+ *
+ * @return 0 - the header or the body runs past the end\n
+ * 1 - success
+ */
+bool binBlockSkip(binCursor *c, //!< Cursor on a block, left after it
+                  binBlock *h //!< In: previous header, out: this one
+                  );
+
+/**
+ * @brief Check the body of a block whose header binBlockSkip read
+ *
+ * The packs and trans must fill exactly the @p h->body bytes at @p p,
+ * which the caller knows are in the data. Every pack can then be read
+ * with binPackGet without bounds checks.
+ * @return 0 - corrupt\n
+ * 1 - success
+ */
+bool binBlockBody(const uint8_t *p, //!< First byte of the body
+                  const binBlock *h, //!< Header of the block
+                  uint32_t *strBytes //!< Out: bytes the strings take with terminators
+                  );
+
+/**
+ * @brief Decode a block header checked earlier by binBlockHeader,
+ * @p c is left on the first pack
+ */
+void binBlockGet(binCursor *c, //!< Cursor on a block
+                 binBlock *h //!< In: previous header, out: this one
+                 );
+
+/**
+ * @brief Read the next pack of a block checked by binBlockHeader or
+ * binBlockBody
+ */
+void binPackGet(binCursor *c, //!< Cursor on a pack
+                binPack *pk //!< Out: the pack
+                );
+
+/**
+ * @brief Intern the urls of a dict into the chain's tracker table
+ *
+ * @p map gets, for every dict id, the id in ch->trackers. Free it with
+ * memFree(MEM_PARSER, map).
+ * @return 0 - truncated dict or malloc failed, @p map is NULL\n
+ * 1 - success
+ */
+bool binDictMap(binCursor *c, //!< Cursor on the dict
+                uint32_t nDict, //!< Entries in the dict
+                chain *ch, //!< Chain whose trackers get the urls
+                uint32_t **map //!< Out: dict id -> tracker id
+                );
+
+/**
+ * @brief Build the next block of a part in its own arena
+ *
+ * @return NULL - truncated, corrupt or malloc failed\n
+ * ptr to the block, free it with deleteBlock
+ */
+block *bin2Block(binCursor *c, //!< Cursor on a block, left after it
+                 binBlock *h, //!< In: previous header, out: this one
+                 const uint32_t *map, //!< Dict id -> tracker id, from binDictMap
+                 uint32_t nMap //!< Entries in map
+                 );
+
+/**
+ * @brief Serialize one block
+ */
+void blockToBin(block *bx, //!< Block to write
+                binBlock *h, //!< In: previous header, out: this one
+                outBuf *ob //!< Destination
+                );
+
+/**
+ * @brief Serialize the part header and the dict, the whole tracker
+ * table of the chain
+ */
+void partHeadBin(chain *ch, //!< Chain being written
+                 uint32_t nBlock, //!< Number of blocks that will follow
+                 uint32_t part, //!< Part number stored in the header
+                 outBuf *ob //!< Destination
+                 );
+
+/**
+ * @brief Write blocks [@p start, @p end) of a chain as one binary part,
+ * with the whole tracker table as its dict
+ *
+ * @return 0 - a write or malloc failed\n
+ * 1 - success
+ */
+bool partToBin(chain *ch, //!< Chain to write
+               uint32_t start, //!< First block
+               uint32_t end, //!< One past the last block
+               uint32_t part, //!< Part number stored in the header
+               FILE *fp //!< Destination, opened "wb"
+               );
+
+/**
+ * @brief Append the blocks of a binary part held in memory to a chain
+ *
+ * Every block is checked against the end of the data before anything
+ * is built, a truncated or corrupt part stops at the last good block.
+ * @return 0 - bad header, truncated data or malloc failed\n
+ * 1 - success
+ */
+bool bin2Chain(const uint8_t *data, //!< Start of the part
+               size_t len, //!< Bytes in the part
+               chain *ch //!< Destination, must be a valid pointer
+               );
+
+/**
+ * @brief Set up an incremental reader
+ *
+ * @return 0 - malloc failed, binStreamEnd must still be called\n
+ * 1 - success
+ */
+bool binStreamInit(binStream *bs //!< Reader to set up
+                   );
+
+/**
+ * @brief Add the next @p len bytes of the part
+ *
+ * Every block whose bytes are all in is built and appended to @p ch,
+ * the rest is kept, a block may be cut anywhere by the pieces.
+ * @return 0 - bad header, corrupt block or malloc failed\n
+ * 1 - success
+ */
+bool binStreamFeed(binStream *bs, //!< Reader
+                   const void *data, //!< Next bytes of the part
+                   uint32_t len, //!< Number of bytes
+                   chain *ch //!< Destination, must be a valid pointer
+                   );
+
+/**
+ * @brief Check that the whole part came in and free the reader
+ *
+ * @return 0 - truncated part, or this or an earlier call failed\n
+ * 1 - success
+ */
+bool binStreamEnd(binStream *bs //!< Reader
+                  );
+
+/**
+ * @brief Read a whole binary part from @p fp and pass it to bin2Chain
+ *
+ * @return Same as bin2Chain
+ */
+bool binFile2Chain(FILE *fp, //!< Part to read, opened "rb"
+                   chain *ch //!< Destination, must be a valid pointer
+                   );
+
+#endif//_CHAINBIN_H
@@ -0,0 +1,135 @@
+/**
+ * @file chainframe.h
+ * @brief Chain part split in independently compressed LZMA frames with
+ * a seek index
+ *
+ * Every frame holds a run of binary blocks (see chainbin.h) compressed
+ * on its own, so reading one block only decompresses its frame and
+ * frames can be decoded in parallel. Little endian, a file is:
+ *
+ *     header   magic "TCHF", u16 version, u16 flags (0), u32 part,
+ *              u32 first block
+ *     frames   raw LZMA data back to back, frame 0 holds the binary
+ *              part header and dict, the others nothing but blocks
+ *     index    per frame: u32 first block, u32 nBlock, u64 offset,
+ *              u32 packed size, u32 raw size, 5 bytes of LZMA props
+ *     trailer  u64 offset of the index, u32 nFrame, magic "TCHI"
+ *
+ * Block numbers in the index are positions in the chain that was
+ * written, [first, first + nBlock) for a frame.
+ */
+#ifndef _CHAINFRAME_H
+#define _CHAINFRAME_H
+
+#include "atype.h"
+
+#define FRAME_MAGIC      "TCHF"     //!< first 4 bytes of a framed part
+#define FRAME_INDEX_MAGIC "TCHI"    //!< last 4 bytes of a framed part
+#define FRAME_VERSION    2          //!< bumped on any layout change
+#define FRAME_HEADER     16         //!< bytes in the file header
+#define FRAME_ENTRY      29         //!< bytes in an index entry
+#define FRAME_TRAILER    16         //!< bytes in the trailer
+#define FRAME_BLOCKS     256        //!< default blocks per frame
+#define FRAME_BYTES      (4U << 20) //!< default raw bytes per frame
+#define FRAME_THREADS    4          //!< decoders used by chainRestore
+
+/**
+ * @brief Index entry of one frame
+ */
+typedef struct
+{
+    uint32_t first;  //!< first block in the frame
+    uint32_t n;      //!< blocks in the frame, 0 for the head frame
+    uint64_t off;    //!< offset of the LZMA data in the file
+    uint32_t packed; //!< compressed bytes
+    uint32_t raw;    //!< uncompressed bytes
+    uint8_t  props[5]; //!< LZMA props of the frame
+}frameEntry;
+
+/**
+ * @brief An open framed part
+ */
+typedef struct
+{
+    FILE       *fp;     //!< the file, reads take lock
+    uint32_t    part;   //!< part number from the header
+    uint32_t    first;  //!< first block of the part
+    uint32_t    nBlock; //!< blocks in the part
+    uint32_t    nFrame; //!< frames, including the head frame
+    frameEntry *idx;    //!< the index, idx[0] is the head frame
+    uint32_t   *map;    //!< dict id -> tracker id of the chain given to frameOpen
+    uint32_t    nMap;   //!< entries in map
+    pthread_mutex_t lock; //!< serializes seek + read on fp
+}frameFile;
+
+/**
+ * @brief Write blocks [@p start, @p end) as a framed part
+ *
+ * A frame is closed once it holds @p nBlock blocks or @p nBytes raw
+ * bytes, whichever comes first.
+ * @return 0 - a write, malloc or the encoder failed\n
+ * 1 - success
+ */
+bool partToFrames(chain *ch, //!< Chain to write
+                  uint32_t start, //!< First block
+                  uint32_t end, //!< One past the last block
+                  uint32_t part, //!< Part number stored in the header
+                  FILE *fp, //!< Destination, opened "wb"
+                  uint32_t nBlock = FRAME_BLOCKS, //!< Most blocks per frame
+                  uint32_t nBytes = FRAME_BYTES //!< Raw bytes that close a frame
+                  );
+
+/**
+ * @brief Open a framed part, read its index and its dict
+ *
+ * The urls of the dict are interned in @p ch, blocks read through the
+ * returned handle use the tracker ids of @p ch.
+ * @return NULL - can't open, bad header, index or head frame\n
+ * ptr to the handle, close it with frameClose
+ */
+frameFile *frameOpen(const char *path, //!< File to open
+                     chain *ch //!< Chain the blocks will belong to
+                     );
+
+/**
+ * @brief Close a framed part, may be NULL
+ */
+void frameClose(frameFile *ff //!< Handle to close
+                );
+
+/**
+ * @brief Find the frame holding block @p n
+ *
+ * @return 0 - no frame holds it (0 is the head frame)\n
+ * index of the frame in ff->idx
+ */
+uint32_t frameFind(const frameFile *ff, //!< Open part
+                   uint32_t n //!< Block number
+                   );
+
+/**
+ * @brief Read block @p n, decompressing only the frame holding it
+ *
+ * @return NULL - no such block, read or decode failed\n
+ * ptr to the block, free it with deleteBlock
+ */
+block *frameReadBlock(frameFile *ff, //!< Open part
+                      uint32_t n //!< Block number
+                      );
+
+/**
+ * @brief Append every block of the part to @p ch, decoding frames with
+ * @p threads workers, the calling thread and tasks of the thread pool
+ *
+ * The blocks are built aside and published together once every frame
+ * decoded, in file order whatever order the frames finish in. On
+ * failure nothing is appended and the built blocks are freed.
+ * @return 0 - a frame failed to read or decode\n
+ * 1 - success
+ */
+bool frameLoad(frameFile *ff, //!< Open part
+               chain *ch, //!< Same chain as given to frameOpen
+               uint8_t threads //!< Decoding threads, at least 1
+               );
+
+#endif//_CHAINFRAME_H
@@ -0,0 +1,106 @@
+/**
+ * @file chainview.h
+ * @brief Read only view of an uncompressed binary part, mapped in
+ * memory instead of loaded
+ *
+ * Nothing is copied out of the file: the only allocations are the
+ * view itself, one offset per dict url and one decoded header per
+ * block, since block headers are delta coded and can't be read on
+ * their own. Blocks are
+ * read with chainViewBlock and their packs walked with binPackGet, the
+ * strings and digests they hand out point into the mapping and are
+ * valid until chainViewClose. Opening walks the block headers once to
+ * index them, jumping over the bodies, a body is checked when its
+ * block is read.
+ *
+ * chainViewLoad turns the view into chain blocks that only hold their
+ * header, the packs are decoded from the mapping the first time they
+ * are asked for (blockPacks).
+ */
+#ifndef _CHAINVIEW_H
+#define _CHAINVIEW_H
+
+#include <string_view>
+
+#include "chainbin.h"
+
+/**
+ * @brief A mapped binary part
+ */
+typedef struct
+{
+    const uint8_t *map;   //!< start of the mapping
+    size_t         len;   //!< bytes mapped
+    binPart        hdr;   //!< part header
+    size_t        *block; //!< offset of the packs of every block
+    binBlock      *head;  //!< header of every block
+    size_t        *dict;  //!< offset of every dict entry
+    uint32_t      *tr;    //!< dict id -> tracker id, set by chainViewLoad
+    blockSrc       src;   //!< decoder of the blocks of chainViewLoad
+#ifdef _WIN32
+    void          *file;  //!< HANDLE of the file
+    void          *fmap;  //!< HANDLE of the mapping
+#endif
+}chainView;
+
+/**
+ * @brief Map a binary part and index its blocks
+ *
+ * @return NULL - the file can't be mapped, or is not a valid part\n
+ * ptr to the view, close it with chainViewClose
+ */
+chainView *chainViewOpen(const char *path //!< Uncompressed binary part
+                         );
+
+/**
+ * @brief Unmap the part and free the view
+ */
+void chainViewClose(chainView *cv //!< View to close, may be NULL
+                    );
+
+//! Number of blocks in the view
+static inline uint32_t chainViewSize(const chainView *cv)
+{
+    return cv->hdr.nBlock;
+}
+
+/**
+ * @brief Get the header of block @p i and a cursor on its packs
+ *
+ * The body is checked first, then read the packs with binPackGet,
+ * exactly h->nPack times.
+ * @return 0 - bad index or the block is corrupt\n
+ * 1 - success
+ */
+bool chainViewBlock(const chainView *cv, //!< View to read
+                    uint32_t i, //!< Index of the block in the part
+                    binBlock *h, //!< Out: the block header
+                    binCursor *packs //!< Out: cursor on the first pack
+                    );
+
+/**
+ * @brief Append every block of the view to @p ch, header only
+ *
+ * Only the headers decoded by chainViewOpen are copied, each block
+ * keeps where its packs are and blockPacks decodes them on first use,
+ * so loading costs one small allocation per block. The crcs are not
+ * checked, chainVerify would decode every block. The view must stay
+ * open until the chain is deleted, and can be loaded once.
+ * @return 0 - loaded already or malloc failed, the chain is untouched\n
+ * 1 - success
+ */
+bool chainViewLoad(chainView *cv, //!< View to load, kept open
+                   chain *ch //!< Destination, must be a valid pointer
+                   );
+
+/**
+ * @brief Url of a tracker id of the part (binPack::tr)
+ *
+ * @return empty - unknown id\n
+ * the url, points into the mapping
+ */
+std::string_view chainViewTracker(const chainView *cv, //!< View to read
+                                  uint32_t tr //!< Id from binPack::tr
+                                  );
+
+#endif//_CHAINVIEW_H
@@ -0,0 +1,50 @@
+/**
+ * @file checkpoint.h
+ * @brief Append only persistence of a chain
+ *
+ * Blocks never change once inserted, so a checkpoint only writes the
+ * blocks added since the previous one, as a new framed segment (see
+ * chainframe.h) named base.N.tcf. A small text manifest, base.mf,
+ * lists the segments in order:
+ *
+ *     Mver : 1,
+ *     Mlast: <blocks persisted>,
+ *     Mseg : <first block> <blocks> <file>,
+ *     ...
+ *
+ * The manifest is written to base.mf.tmp and renamed over the old one
+ * after the segment is on disk. Both files are synced before the
+ * rename and the directory after it, so a crash or power loss leaves
+ * either the old or the new checkpoint, never a mix.
+ */
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include "atype.h"
+
+#define MANIFEST_VERSION 1 //!< Mver of the manifests written
+
+/**
+ * @brief Persist the blocks added since the last checkpoint of @p base
+ *
+ * Nothing is written when no block was added. The first checkpoint of
+ * a base writes the whole chain.
+ * @return 0 - a write failed or the manifest does not match the chain\n
+ * 1 - success
+ */
+bool chainCheckpoint(chain *ch, //!< Chain to persist
+                     const char *base, //!< Path prefix of the manifest and segments
+                     uint32_t *saved = NULL //!< Out: blocks written, may be NULL
+                     );
+
+/**
+ * @brief Load every segment listed in the manifest of @p base
+ *
+ * @return NULL - no manifest, a segment is missing or corrupt, or a
+ * block fails its crc\n
+ * ptr to a new chain
+ */
+chain *chainRestore(const char *base //!< Path prefix given to chainCheckpoint
+                    );
+
+#endif//_CHECKPOINT_H
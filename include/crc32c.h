@@ -0,0 +1,39 @@
+/**
+ * @file crc32c.h
+ * @brief CRC32C (Castagnoli), with the SSE4.2 crc32 instruction when
+ * the cpu has it and a slicing by 8 table otherwise
+ *
+ * The implementation is picked once, on the first call.
+ */
+#ifndef _CRC32C_H
+#define _CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Update a CRC32C with @p len bytes
+ *
+ * Start with 0, feed the result back in to continue over more data:
+ * crc32c(crc32c(0, a, n), b, m) is the crc of a followed by b.
+ * @return the crc of everything fed so far
+ */
+uint32_t crc32c(uint32_t crc, //!< Crc so far, 0 to start
+                const void *data, //!< Bytes to add
+                size_t len //!< Number of bytes
+                );
+
+/**
+ * @brief Portable crc32c, same results, for tests and benchmarks
+ */
+uint32_t crc32cTable(uint32_t crc, //!< Crc so far, 0 to start
+                     const void *data, //!< Bytes to add
+                     size_t len //!< Number of bytes
+                     );
+
+/**
+ * @brief 1 if crc32c uses the crc32 instruction
+ */
+bool crc32cHw(void);
+
+#endif//_CRC32C_H
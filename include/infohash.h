@@ -0,0 +1,70 @@
+/**
+ * @file infohash.h
+ * @brief Parsing and printing of the exact topic (xt) of a magnet link
+ *
+ * BitTorrent topics are urn:btih: followed by a sha1 digest as 40 hex
+ * or 32 base32 chars, these are kept as the 20 raw bytes. Any other
+ * URN is kept as a string.
+ */
+#ifndef _INFOHASH_H
+#define _INFOHASH_H
+
+#include <string.h>
+#include "atype.h"
+
+/** @brief Prefix of BitTorrent info hash URNs */
+#define XT_BTIH_PREFIX "urn:btih:"
+
+/** @brief Length of XT_BTIH_PREFIX */
+#define XT_BTIH_PREFIX_LEN 9
+
+/** @brief Buffer size that fits any printed btih URN, terminator included */
+#define XT_BTIH_MAX (XT_BTIH_PREFIX_LEN + 40 + 1)
+
+/**
+ * @brief Parse a urn:btih: topic into its binary digest
+ *
+ * @return XT_STR - not a btih URN (or a malformed one)\n
+ * XT_BTIH_HEX or XT_BTIH_B32 - @p out holds the digest
+ */
+uint8_t xtParse(const char *xt, //!< Topic to parse
+                uint32_t len, //!< Length of xt
+                infohash *out //!< Destination of the digest
+                );
+
+/**
+ * @brief Print the topic of a pack the way it was given
+ *
+ * Hex digests come out lower case and base32 digests upper case.
+ * @return Length of the topic, @p buf is only written to for btih
+ * topics, for XT_STR @p out points at the pack's string
+ */
+uint32_t xtFormat(const pack *pk, //!< Pack to print the topic of
+                  char *buf, //!< Buffer of at least XT_BTIH_MAX chars
+                  const char **out //!< Out: ptr to the null terminated topic
+                  );
+
+/**
+ * @brief Compare two digests, two 64 bit and one 32 bit compare
+ */
+static inline bool infohashEq(const infohash *a, const infohash *b)
+{
+    uint64_t a0, a1, b0, b1;
+    uint32_t a2, b2;
+    memcpy(&a0, a->b, 8); memcpy(&a1, a->b + 8, 8); memcpy(&a2, a->b + 16, 4);
+    memcpy(&b0, b->b, 8); memcpy(&b1, b->b + 8, 8); memcpy(&b2, b->b + 16, 4);
+    return ((a0 ^ b0) | (a1 ^ b1) | (uint64_t)(a2 ^ b2)) == 0;
+}
+
+/**
+ * @brief Hash of a digest for hash tables, the digest is already
+ * uniform so its first 8 bytes are enough
+ */
+static inline uint64_t infohashHash(const infohash *a)
+{
+    uint64_t h;
+    memcpy(&h, a->b, 8);
+    return h;
+}
+
+#endif//_INFOHASH_H
@@ -17,6 +17,10 @@
 /** @brief Size of prop and the following data that contains the filesize */
 #define LZMA_PROPS_SIZE_FILESIZE LZMA_PROPS_SIZE + 8
 
+/** @brief Filesize stored when it is not known, the data ends with an
+ * end marker instead */
+#define LZMA_SIZE_UNKNOWN ((unsigned long)-1)
+
 /**
  * @brief Default prop values
  *
@@ -111,12 +115,27 @@ int compress_data_incr(FILE *input, //!< Fp to input file
                        const CLzmaEncProps *args = &default_props //!< Arguments to pass to the encode fn
                        );
 
+/**
+ * @brief Compress whatever @p in produces, without knowing its size
+ *
+ * The header stores LZMA_SIZE_UNKNOWN and the data ends with an end
+ * marker, decompress_data_incr handles both.
+ * @return
+ * 1 - success\n
+ * 0 - failure
+ */
+int compress_stream(ISeqInStream *in, //!< Data to compress, read until it returns 0 bytes
+                    FILE *output, //!< Fp to output file
+                    const CLzmaEncProps *args = &default_props //!< Arguments to pass to the encode fn
+                    );
+
 /**
  * @brief Decompress data incrementally
  *
  * Reads file size and then calculates how much more is left to read
  * based on how much data has alrdy been processed, it knows its
- * done when its processed "file_size" bytes of data
+ * done when its processed "file_size" bytes of data, or at the end
+ * marker when the size is LZMA_SIZE_UNKNOWN
  * 
  * @return
  * Not implemented yet
@@ -124,4 +143,53 @@ int compress_data_incr(FILE *input, //!< Fp to input file
 int decompress_data_incr(FILE *input, //!< Fp to compressed file
                          FILE *output //!< Fp to dest
                          );
+
+/**
+ * @brief Decompress a file made by compress_data_incr or
+ * compress_stream, handing the data to @p output as it is decoded
+ *
+ * @p output gets at most buffer_cread_size bytes per call, decoding
+ * stops with a failure if it writes fewer than it was given.
+ * @return
+ * 1 - success\n
+ * 0 - failure
+ */
+int decompress_to_stream(FILE *input, //!< Fp to compressed file
+                         ISeqOutStream *output //!< Destination of the data
+                         );
+
+/**
+ * @brief Worst case size of compress_buf output for @p len bytes
+ */
+#define LZMA_BUF_BOUND(len) ((len) + (len) / 3 + 128)
+
+/**
+ * @brief Compress a buffer in one call, no header is written
+ *
+ * The caller keeps @p props and both sizes to decompress it.
+ * @return
+ * 1 - success\n
+ * 0 - failure, @p dest was too small or the encoder failed
+ */
+int compress_buf(unsigned char *dest, //!< Output buffer
+                 size_t *dest_len, //!< In: size of dest, out: bytes written
+                 const unsigned char *src, //!< Data to compress
+                 size_t src_len, //!< Size of @p src
+                 unsigned char *props, //!< Out: LZMA_PROPS_SIZE bytes of props
+                 const CLzmaEncProps *args = &default_props //!< Arguments to pass to the encode fn
+                 );
+
+/**
+ * @brief Decompress a buffer made by compress_buf
+ *
+ * @return
+ * 1 - success, exactly @p dest_len bytes were produced\n
+ * 0 - failure
+ */
+int decompress_buf(unsigned char *dest, //!< Output buffer
+                   size_t dest_len, //!< Uncompressed size
+                   const unsigned char *src, //!< Compressed data
+                   size_t src_len, //!< Size of @p src
+                   const unsigned char *props //!< Props from compress_buf
+                   );
 #endif // _LZMA2_WRAPPER_H
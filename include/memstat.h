@@ -0,0 +1,96 @@
+/**
+ * @file memstat.h
+ * @brief Memory accounting per subsystem
+ *
+ * Every allocation of the chain code goes through memAlloc and friends
+ * with the subsystem it belongs to. Sizes are taken from the allocator
+ * (malloc_usable_size/_msize) plus its per chunk header, so the live
+ * byte counts are what the process really holds, not what was asked
+ * for. Counters are updated atomically and can be read at any time.
+ */
+#ifndef _MEMSTAT_H
+#define _MEMSTAT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/**
+ * @brief Subsystems memory is accounted to
+ */
+enum MemSub
+{
+    MEM_CHAIN = 0,   //!< chain struct, block directory and its segments
+    MEM_BLOCK,       //!< block arenas: headers, packs and their strings
+    MEM_STRING,      //!< interned strings (tracker table)
+    MEM_PARSER,      //!< buffers and temporaries of the text loaders
+    MEM_IO,          //!< serialization buffers
+    MEM_LZMA,        //!< encoder/decoder state routed through g_Alloc
+    MEM_POOL,        //!< task queues of the thread pool
+    MEM_NSUB         //!< number of subsystems, must be last
+};
+
+/**
+ * @brief Counters of one subsystem
+ */
+typedef struct
+{
+    uint64_t live;   //!< bytes currently held
+    uint64_t peak;   //!< highest value live reached
+    uint64_t allocs; //!< number of allocations made
+    uint64_t frees;  //!< number of allocations released
+}memStat;
+
+/**
+ * @brief malloc accounted to @p sub
+ */
+void *memAlloc(uint8_t sub, //!< MemSub to charge
+               size_t size //!< Bytes to allocate
+               );
+
+/**
+ * @brief calloc accounted to @p sub
+ */
+void *memCalloc(uint8_t sub, //!< MemSub to charge
+                size_t n, //!< Number of elements
+                size_t size //!< Size of an element
+                );
+
+/**
+ * @brief realloc accounted to @p sub, @p ptr must be from the same one
+ */
+void *memRealloc(uint8_t sub, //!< MemSub to charge
+                 void *ptr, //!< Allocation to resize, can be NULL
+                 size_t size //!< New size
+                 );
+
+/**
+ * @brief free accounted to @p sub, NULL is ignored
+ */
+void memFree(uint8_t sub, //!< MemSub the allocation was charged to
+             void *ptr //!< Allocation to release
+             );
+
+/**
+ * @brief Read the counters of a subsystem
+ *
+ * @p sub == MEM_NSUB gives the sum over all subsystems, its peak is
+ * the peak of the process wide total.
+ */
+void memGet(uint8_t sub, //!< MemSub to read, or MEM_NSUB
+            memStat *out //!< Destination of the counters
+            );
+
+/**
+ * @brief Name of a subsystem, "total" for MEM_NSUB
+ */
+const char *memName(uint8_t sub //!< MemSub
+                    );
+
+/**
+ * @brief Print a table of every subsystem and the total
+ */
+void memDump(FILE *fp //!< Destination
+             );
+
+#endif//_MEMSTAT_H
@@ -0,0 +1,202 @@
+/**
+ * @file outbuf.h
+ * @brief Buffered writer for the chain serializers
+ *
+ * Bytes are gathered in one MEM_IO buffer and handed to fwrite a
+ * buffer at a time instead of a field at a time. Errors are sticky:
+ * after the first failed write or malloc every later write is dropped
+ * and outBufFlush reports it, so callers only check once at the end.
+ * The put helpers store integers little endian whatever the host is.
+ *
+ * Without a file the writer is a growable memory buffer: nothing is
+ * flushed, the caller takes buf/len and resets len itself.
+ */
+#ifndef _OUTBUF_H
+#define _OUTBUF_H
+
+#include <string.h>
+
+#include "atype.h"
+
+/** @brief Default size of the buffer (64kb) */
+#define OUTBUF_SIZE 65536
+
+/** @brief Buffer size of the part writers (4mb) */
+#define OUTBUF_LARGE (4U << 20)
+
+/** @brief Append a string literal, its length is known at compile time */
+#define outBufLit(ob, s) outBufWrite((ob), (s), sizeof(s) - 1)
+
+/**
+ * @brief Set up a writer for @p fp
+ *
+ * @return 0 - malloc failed, the writer is in the error state\n
+ * 1 - success
+ */
+bool outBufInit(outBuf *ob, //!< Writer to initialize
+                FILE *fp, /**< Destination, must stay open until
+                             outBufFree, NULL to only fill memory */
+                uint32_t cap = OUTBUF_SIZE //!< Size of the buffer
+                );
+
+/**
+ * @brief Write everything pending to the file, no-op without a file
+ *
+ * @return 0 - a write failed now or earlier\n
+ * 1 - success
+ */
+bool outBufFlush(outBuf *ob //!< Writer to flush
+                 );
+
+/**
+ * @brief Flush and free the buffer, the file is not closed
+ *
+ * @return Same as outBufFlush
+ */
+bool outBufFree(outBuf *ob //!< Writer to release
+                );
+
+/**
+ * @brief Append @p len bytes when they don't fit, larger writes bypass
+ * the buffer or, without a file, grow it
+ */
+void outBufSlow(outBuf *ob, //!< Writer to append to
+                const void *data, //!< Bytes to write
+                uint32_t len //!< Number of bytes
+                );
+
+/**
+ * @brief Make room for @p len bytes when they don't fit, see outBufRoom
+ */
+char *outBufRoomSlow(outBuf *ob, //!< Writer to make room in
+                     uint32_t len //!< Number of bytes
+                     );
+
+/**
+ * @brief Make room for @p len bytes to be stored in place
+ *
+ * The caller stores at most @p len bytes at the returned pointer and
+ * adds what it stored to ob->len, one check for a whole record
+ * instead of one per field.
+ * @return NULL - the writer failed or @p len exceeds the buffer of a
+ * file writer, write the fields one by one\n
+ * ptr to the free bytes
+ */
+static inline char *outBufRoom(outBuf *ob, uint32_t len)
+{
+    if (ob->cap - ob->len >= len)
+        return ob->buf + ob->len;
+    return outBufRoomSlow(ob, len);
+}
+
+/**
+ * @brief Append @p len bytes
+ */
+static inline void outBufWrite(outBuf *ob, const void *data, uint32_t len)
+{
+    if (ob->cap - ob->len >= len) {
+        memcpy(ob->buf + ob->len, data, len);
+        ob->len += len;
+    } else {
+        outBufSlow(ob, data, len);
+    }
+}
+
+static inline void outBufPut8(outBuf *ob, uint8_t v)
+{
+    outBufWrite(ob, &v, 1);
+}
+
+static inline void outBufPut16(outBuf *ob, uint16_t v)
+{
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    outBufWrite(ob, b, 2);
+}
+
+static inline void outBufPut32(outBuf *ob, uint32_t v)
+{
+    uint8_t b[4];
+    for (int i = 0; i < 4; i++)
+        b[i] = (uint8_t)(v >> (8 * i));
+    outBufWrite(ob, b, 4);
+}
+
+static inline void outBufPut64(outBuf *ob, uint64_t v)
+{
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++)
+        b[i] = (uint8_t)(v >> (8 * i));
+    outBufWrite(ob, b, 8);
+}
+
+/* Little endian stores at @p p for outBufRoom, return the next byte */
+static inline char *outBufStore16(char *p, uint16_t v)
+{
+    p[0] = (char)v;
+    p[1] = (char)(v >> 8);
+    return p + 2;
+}
+
+static inline char *outBufStore32(char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (char)(v >> (8 * i));
+    return p + 4;
+}
+
+static inline char *outBufStore64(char *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (char)(v >> (8 * i));
+    return p + 8;
+}
+
+/**
+ * @brief Append @p v as a LEB128 varint, 7 bits per byte, low first
+ */
+static inline void outBufVar(outBuf *ob, uint64_t v)
+{
+    uint8_t b[10];
+    int i = 0;
+    for (; v >= 0x80; v >>= 7)
+        b[i++] = (uint8_t)v | 0x80;
+    b[i++] = (uint8_t)v;
+    outBufWrite(ob, b, i);
+}
+
+/**
+ * @brief Append a null terminated string
+ */
+static inline void outBufStr(outBuf *ob, const char *s)
+{
+    outBufWrite(ob, s, strlen(s));
+}
+
+/**
+ * @brief Append @p v in decimal, same digits as printf %lu
+ */
+static inline void outBufU64(outBuf *ob, uint64_t v)
+{
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    outBufWrite(ob, p, tmp + sizeof(tmp) - p);
+}
+
+/**
+ * @brief Append @p v in decimal, same digits as printf %ld
+ */
+static inline void outBufI64(outBuf *ob, int64_t v)
+{
+    if (v < 0) {
+        outBufPut8(ob, '-');
+        outBufU64(ob, 0 - (uint64_t)v);
+    } else {
+        outBufU64(ob, v);
+    }
+}
+
+#endif//_OUTBUF_H
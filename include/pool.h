@@ -0,0 +1,87 @@
+/**
+ * @file pool.h
+ * @brief Process wide work stealing thread pool for the chain operations
+ *
+ * Every worker owns a deque of tasks: it pushes and pops its own at the
+ * back and, once it runs dry, steals the oldest task at the front of
+ * another one. Tasks submitted from outside the pool are dealt round
+ * robin. The workers are started once, on first use or by poolStart,
+ * and stay until poolStop, so no thread is created per call and a call
+ * with more parts than cores queues them instead of oversubscribing.
+ *
+ * A task runs to completion on one thread, it must not block on
+ * another task except through poolWait, which runs queued tasks while
+ * it waits.
+ */
+#ifndef _POOL_H
+#define _POOL_H
+
+#include "atype.h"
+
+#define POOL_MAX 256 //!< most workers poolStart starts
+
+/**
+ * @brief Task, same signature as a pthread start routine, the return
+ * value is dropped
+ */
+typedef void *(*poolFn)(void *);
+
+/**
+ * @brief Tasks poolWait waits for, zero it with poolGroupInit
+ */
+typedef struct
+{
+    uint32_t pending; //!< submitted and not finished yet
+}poolGroup;
+
+/**
+ * @brief Start the workers, a no-op if they run already
+ *
+ * @return 0 - no thread could be started, tasks run inline\n
+ * 1 - success
+ */
+bool poolStart(uint32_t threads = 0 /**< Number of workers, 0 for
+                                       the hardware thread count */
+               );
+
+/**
+ * @brief Run every queued task, stop the workers and free the queues
+ *
+ * The pool starts again on the next submit. Nothing may be submitting
+ * while it stops.
+ */
+void poolStop(void);
+
+/**
+ * @brief Number of workers, starting the pool if it is not yet
+ *
+ * @return at least 1, a pool that could not start runs tasks inline
+ */
+uint32_t poolThreads(void);
+
+/**
+ * @brief Empty a group
+ */
+static inline void poolGroupInit(poolGroup *g)
+{
+    g->pending = 0;
+}
+
+/**
+ * @brief Queue @p fn(@p arg) as part of @p g
+ *
+ * Runs it right away on the calling thread if the pool can't start or
+ * the queue can't grow.
+ */
+void poolSubmit(poolGroup *g, //!< Group the task belongs to
+                poolFn fn, //!< Task
+                void *arg //!< Passed to fn
+                );
+
+/**
+ * @brief Wait for every task of @p g, running queued tasks meanwhile
+ */
+void poolWait(poolGroup *g //!< Group to wait for
+              );
+
+#endif//_POOL_H
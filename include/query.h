@@ -0,0 +1,62 @@
+/**
+ * @file query.h
+ * @brief Scans over the packs of a chain
+ *
+ * Every query works on the columnar layout (see blockCols) so each one
+ * only touches the arrays it needs. Blocks without columns get them
+ * built on first use through blockColumns.
+ */
+#ifndef _QUERY_H
+#define _QUERY_H
+
+#include "atype.h"
+
+/**
+ * @brief Sum of the exact lengths of the packs of a block
+ */
+uint64_t colsTotalSize(const blockCols *c //!< Columns of the block
+                       );
+
+/**
+ * @brief Find the largest pack of a block
+ *
+ * @return Index of the pack with the biggest xl, c->n if empty
+ */
+uint16_t colsLargest(const blockCols *c //!< Columns of the block
+                     );
+
+/**
+ * @brief Find the packs of a block announced on tracker @p tr
+ *
+ * @return Number of packs found, their indexes are written to @p out
+ */
+uint16_t colsFilterTracker(const blockCols *c, //!< Columns of the block
+                           uint32_t tr, //!< Tracker id
+                           uint16_t *out //!< Room for c->n indexes
+                           );
+
+/**
+ * @brief Sum of the exact lengths of every pack in the chain
+ */
+uint64_t chainTotalSize(chain *ch //!< Chain to scan
+                        );
+
+/**
+ * @brief Find the largest pack in the chain
+ *
+ * @return 0 - chain has no packs\n
+ * 1 - @p blk and @p pk hold the block and pack index
+ */
+bool chainLargest(chain *ch, //!< Chain to scan
+                  uint32_t *blk, //!< Out: block index
+                  uint16_t *pk //!< Out: pack index in the block
+                  );
+
+/**
+ * @brief Count the packs of the chain announced on tracker @p tr
+ */
+uint64_t chainCountTracker(chain *ch, //!< Chain to scan
+                           uint32_t tr //!< Tracker id
+                           );
+
+#endif//_QUERY_H
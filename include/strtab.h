@@ -0,0 +1,59 @@
+/**
+ * @file strtab.h
+ * @brief String interning, used for the chain wide tracker table
+ *
+ * Magnet links repeat the same few tracker urls over and over, so
+ * packs only hold an id into the chain's table. Ids are handed out in
+ * order starting at 0 and never change.
+ */
+#ifndef _STRTAB_H
+#define _STRTAB_H
+
+#include "atype.h"
+
+/** @brief Returned by strtabIntern on failure */
+#define STRTAB_NONE MAX_U32
+
+/**
+ * @brief Set a table to the empty state, does not allocate
+ */
+void strtabInit(strtab *tab //!< Table to initialize
+                );
+
+/**
+ * @brief Get the id of a string, adding it to the table if needed
+ *
+ * Thread safe, takes the table's lock.
+ * @return STRTAB_NONE - malloc failed\n
+ * id of the string
+ */
+uint32_t strtabIntern(strtab *tab, //!< Table to look in
+                      const char *str, //!< String to intern
+                      uint32_t len //!< Length of str
+                      );
+
+/**
+ * @brief Get the string with id @p id
+ *
+ * Lock free, safe while other threads intern.
+ * @return NULL - no such id\n
+ * ptr to the string, owned by the table
+ */
+static inline const char *strtabGet(const strtab *tab, //!< Table to look in
+                                    uint32_t id //!< Id from strtabIntern
+                                    )
+{
+    if (id >= __atomic_load_n(&tab->n, __ATOMIC_ACQUIRE))
+        return NULL;
+    return __atomic_load_n(&tab->ent, __ATOMIC_ACQUIRE)[id].str;
+}
+
+/**
+ * @brief Free everything held by the table and reset it
+ *
+ * @return Number of bytes released
+ */
+uint32_t strtabFree(strtab *tab //!< Table to free
+                    );
+
+#endif//_STRTAB_H
@@ -0,0 +1,219 @@
+/**
+ * @file textparse.h
+ * @brief Parser of the {B/{P text parts over a buffer held in memory
+ *
+ * Replaces the fgets + indexes_of loaders of alibio (kept for
+ * comparison): the part is read in one go and walked line by line
+ * once, values are views into the buffer and numbers are parsed
+ * exactly with std::from_chars. The packs of a block are gathered as
+ * views in a scratch array reused from block to block, then built with
+ * BlockBuilder once their sizes are known, so nothing is allocated per
+ * field or per pack.
+ *
+ * Lines are found by a structural scan: a window of the part at a time
+ * is turned into the list of its newline offsets, 64 bytes per step
+ * with AVX2 or SSE2 compares (picked at runtime, scalar elsewhere).
+ * Newlines are the only delimiter that can't show up inside a value,
+ * the tag at the start of each line says what it holds.
+ *
+ * Lines have no length limit. Trans are skipped, like the other
+ * loaders do.
+ */
+#ifndef _TEXTPARSE_H
+#define _TEXTPARSE_H
+
+#include <stddef.h>
+#include <string_view>
+
+#include "atype.h"
+
+#define TEXT_WINDOW 8192 //!< bytes indexed by one structural scan
+
+/**
+ * @brief Read position in a text part, set it up with textCursorInit
+ */
+typedef struct
+{
+    const char *p;    //!< next byte
+    const char *end;  //!< one past the last byte
+    const char *win;  //!< start of the window idx refers to
+    const char *next; //!< first byte not scanned yet
+    uint32_t    nIdx; //!< newlines in the window
+    uint32_t    iIdx; //!< next newline to hand out
+    uint16_t    idx[TEXT_WINDOW]; //!< offsets of the newlines from win
+}textCursor;
+
+/**
+ * @brief Cdict ids of the part -> tracker ids of the chain
+ */
+typedef struct
+{
+    uint32_t *id; //!< STRTAB_NONE for ids the part did not define
+    uint32_t  n;  //!< entries in id
+}textDict;
+
+/**
+ * @brief Fields of one {P, every view points into the part
+ */
+typedef struct
+{
+    std::string_view dn;
+    std::string_view xt;
+    std::string_view tr; //!< dict id, or a url in older parts
+    uint64_t xl;
+}textPack;
+
+/**
+ * @brief Per parser scratch, zero it before first use and free it with
+ * textParseFree(NULL, &s)
+ */
+typedef struct
+{
+    textPack *pk;  //!< packs of the block being parsed
+    uint32_t  cap; //!< room in pk
+}textScratch;
+
+/**
+ * @brief Incremental parser for a text part that arrives in pieces, set
+ * it up with textStreamInit
+ *
+ * Errors are sticky, every later call fails once one did.
+ */
+typedef struct
+{
+    outBuf      in;   //!< text not parsed yet, starts on a line
+    textDict    dict; //!< Cdict lines seen so far
+    textScratch s;    //!< scratch of text2BlockBuf
+    textCursor *c;    //!< cursor over the parsed run of in
+    bool        eof;  //!< the EOF line was seen, the rest is ignored
+    bool        ok;   //!< 0 once a block failed or malloc failed
+}textStream;
+
+/**
+ * @brief Point a cursor at [@p data, @p data + @p len)
+ */
+void textCursorInit(textCursor *c, //!< Cursor to set up
+                    const char *data, //!< Start of the text
+                    size_t len //!< Bytes of text
+                    );
+
+/**
+ * @brief Structural scan, write the offset of every newline of
+ * [@p p, @p p + @p len) to @p out
+ *
+ * @return Number of offsets written, at most @p len
+ */
+uint32_t textScanLines(const char *p, //!< Start of the window
+                       uint32_t len, //!< Bytes, at most 65536
+                       uint16_t *out //!< Room for @p len offsets
+                       );
+
+/**
+ * @brief Portable textScanLines, same results, for tests and benchmarks
+ */
+uint32_t textScanLinesScalar(const char *p, //!< Start of the window
+                             uint32_t len, //!< Bytes, at most 65536
+                             uint16_t *out //!< Room for @p len offsets
+                             );
+
+/**
+ * @brief Name of the scan textScanLines uses: "avx2", "sse2" or
+ * "scalar"
+ */
+const char *textScanName(void);
+
+/**
+ * @brief Add a "Cdict: <id> <url>," line to the dict, the url is
+ * interned in @p ch
+ *
+ * @return 0 - malformed line or malloc failed\n
+ * 1 - success
+ */
+bool textDictLine(textDict *dict, //!< Dict of the part
+                  std::string_view line, //!< The line, without newline
+                  chain *ch //!< Chain whose trackers get the url
+                  );
+
+/**
+ * @brief Build the block that follows a {B line
+ *
+ * @p c must be right after the {B line, it is left after the B} line.
+ * @return NULL - truncated, bad number or malloc failed\n
+ * ptr to the block, free it with deleteBlock
+ */
+block *text2BlockBuf(textCursor *c, //!< Cursor on the block
+                     const textDict *dict, //!< Dict read so far
+                     chain *ch, //!< Chain the tracker ids belong to
+                     textScratch *s //!< Scratch of this parser
+                     );
+
+/**
+ * @brief Append every block of a text part held in memory to @p ch
+ *
+ * The blocks after the Cdict lines are cut in @p threads byte ranges,
+ * each moved forward to the next {B line, and parsed by tasks of the
+ * thread pool, the calling thread takes the last one. The ranges are
+ * appended in file order with one chainReserve. Cdict lines must come
+ * before the first block, as partHeadText writes them.
+ * @return 0 - a block is truncated or corrupt, or malloc failed, the
+ * chain keeps the blocks before it\n
+ * 1 - success
+ */
+bool textBuf2Chain(const char *data, //!< Start of the part
+                   size_t len, //!< Bytes in the part
+                   chain *ch, //!< Destination, must be a valid pointer
+                   uint8_t threads = 1 //!< Parsing threads, at least 1
+                   );
+
+/**
+ * @brief Read a whole text part from @p fp and pass it to textBuf2Chain
+ *
+ * @return Same as textBuf2Chain
+ */
+bool textFile2Chain(FILE *fp, //!< Part to read
+                    chain *ch, //!< Destination, must be a valid pointer
+                    uint8_t threads = 1 //!< Parsing threads, at least 1
+                    );
+
+/**
+ * @brief Set up an incremental parser
+ *
+ * @return 0 - malloc failed, textStreamEnd must still be called\n
+ * 1 - success
+ */
+bool textStreamInit(textStream *ts //!< Parser to set up
+                    );
+
+/**
+ * @brief Add the next @p len bytes of the part
+ *
+ * Every block that is complete, i.e. followed by the {B line of
+ * another, is built and appended to @p ch. The rest is kept, a block
+ * may be cut anywhere by the pieces.
+ * @return 0 - a block is truncated or corrupt, or malloc failed\n
+ * 1 - success
+ */
+bool textStreamFeed(textStream *ts, //!< Parser
+                    const void *data, //!< Next bytes of the part
+                    uint32_t len, //!< Number of bytes
+                    chain *ch //!< Destination, must be a valid pointer
+                    );
+
+/**
+ * @brief Parse what is left at the end of the part and free the parser
+ *
+ * @return 0 - this or an earlier call failed\n
+ * 1 - success
+ */
+bool textStreamEnd(textStream *ts, //!< Parser
+                   chain *ch //!< Destination, must be a valid pointer
+                   );
+
+/**
+ * @brief Free what a textDict or textScratch holds, either may be NULL
+ */
+void textParseFree(textDict *dict, //!< Dict to free
+                   textScratch *s //!< Scratch to free
+                   );
+
+#endif//_TEXTPARSE_H
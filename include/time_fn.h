@@ -4,6 +4,18 @@
 #ifndef _TIME_FN_H
 #define _TIME_FN_H
 
+#include <stdint.h>
+
 struct tm *get_loc_time();
 
+/**
+ * @brief Milliseconds on a monotonic clock, for timings
+ */
+uint32_t msNow(void);
+
+/**
+ * @brief Microseconds on a monotonic clock, for timings of short steps
+ */
+uint64_t usNow(void);
+
 #endif // _TIME_H_FN
@@ -7,7 +7,14 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 #include "alib.h"
+#include "arena.h"
+#include "strtab.h"
+#include "infohash.h"
+#include "blockbuilder.h"
+#include "memstat.h"
 #include "lzma_wrapper.h"
+#include "crc32c.h"
+#include "pool.h"
 #include "log.h"
 
 namespace pt = boost::posix_time;
@@ -40,46 +47,51 @@ void printBlock(block *target)
     printf("\n");
 }
 
-pack *newPack(char *dn, uint64_t xl, char *xt, char *tr)
+pack *newPack(char *dn, uint64_t xl, char *xt, uint32_t tr)
 {
     uint32_t ndn = strlen(dn) + 1;
     uint32_t nxt = strlen(xt) + 1;
-    uint32_t ntr = strlen(tr) + 1;
     uint8_t i;
     
-    if (ndn > MAX_U8 || nxt > MAX_U8 || ntr > MAX_U8) 
+    if (ndn - 1 > PACK_STR_MAX || nxt - 1 > PACK_STR_MAX) {
+        log_msg_custom("Pack string too long");
         return NULL;
+    }
     
-    pack *px = (pack *)malloc(sizeof(pack));
+    pack *px = (pack *)memAlloc(MEM_BLOCK, sizeof(pack));
     if (!px)
         return NULL; // maloc failed
 
     px->xl = xl;
+    px->dn = NULL;
+    px->xtType = XT_STR;
+    px->xt.str = NULL;
     for (i = 0; i < 6; i++) {
         px->info[i] = 0; // prevent valgrind errors
     }
     strncpy(px->info, dn, 5);
     
-    px->dn = (char *)malloc(sizeof(char) * ndn);
+    px->dn = (char *)memAlloc(MEM_BLOCK, sizeof(char) * ndn);
     if (!px->dn)
 	goto cleanup;
     strcpy(px->dn, dn);
     
-    px->xt = (char *)malloc(sizeof(char) * nxt);
-    if (!px->xt)
-	goto cleanup;
-    strcpy(px->xt, xt);
+    // btih topics are kept as the raw digest, no allocation
+    px->xtType = xtParse(xt, nxt - 1, &px->xt.hash);
+    if (px->xtType == XT_STR) {
+        px->xt.str = (char *)memAlloc(MEM_BLOCK, sizeof(char) * nxt);
+        if (!px->xt.str)
+            goto cleanup;
+        strcpy(px->xt.str, xt);
+    }
     
-    px->tr = (char *)malloc(sizeof(char) * ntr);
-    if (!px->tr)
-	goto cleanup;
-    strcpy(px->tr, tr);
+    px->tr = tr;
     return px;
     
  cleanup:
     log_msg_default;
     deletePack(px);
-    free(px);
+    memFree(MEM_BLOCK, px);
     return NULL;
 }
 
@@ -88,118 +100,604 @@ tran *newTran()
     return NULL;
 }
 
-block *newBlock(uint32_t n, uint64_t key, uint32_t nPack, pack **packs)
+/* Copy heap packs into a builder, then free them and the array
+ *
+ * @return 0 if the builder is empty or a pack could not be added (a
+ * string over PACK_STR_MAX, more than MAX_U16 packs, malloc), the
+ * packs are freed anyway
+ */
+static bool adoptPacks(BlockBuilder &bb, uint32_t nPack, pack **packs)
 {
-    block *bx = (block *)malloc(sizeof(block));
-    if (bx == NULL) {
-	return NULL;
-        log_msg_default;
+    bool ok = bb.ok();
+    for (uint32_t i = 0; i < nPack; i++) {
+        if (packs[i] == NULL)
+            continue;
+        ok = ok && bb.add(PackView(packs[i])) != NULL;
+        deletePack(packs[i]);
+        memFree(MEM_BLOCK, packs[i]);
     }
+    memFree(MEM_PARSER, packs); // pack arrays come from the loaders
+    if (!ok)
+        log_msg_custom("Building a block from packs failed");
+    return ok;
+}
 
-    bx->time = (uint32_t)sNow();
-    bx->crc = 0;
-    bx->n = n;
-    bx->key = key;
-    
-    if (nPack < MAX_U16) {
-        bx->nPack = nPack;
-        bx->packs = packs;
-    } else {
-        bx->nPack = MAX_U16;
-        for (uint32_t i = MAX_U16; i < nPack; i++) {
-            free(packs[i]);
-        }
-        bx->packs = (pack **)realloc(packs, sizeof(pack *) * MAX_U16);
+/* Bytes the strings of heap packs will take in an arena */
+static uint32_t packsStrBytes(uint32_t nPack, pack **packs)
+{
+    uint32_t bytes = 0;
+    for (uint32_t i = 0; i < nPack && i < MAX_U16; i++) {
+        if (packs[i] == NULL)
+            continue;
+        bytes += strlen(packs[i]->dn) + 1;
+        if (packs[i]->xtType == XT_STR)
+            bytes += strlen(packs[i]->xt.str) + 1;
     }
-    bx->nTran = 0;
-    bx->trans = NULL;
+    return bytes;
+}
+
+block *newBlock(uint32_t n, uint64_t key, uint32_t nPack, pack **packs)
+{
+    uint16_t cap = nPack < MAX_U16 ? nPack : MAX_U16;
+    BlockBuilder bb(n, key, cap, packsStrBytes(nPack, packs));
+    if (!adoptPacks(bb, nPack, packs))
+        return NULL;
 
     if (LOG) 
 	printTime(sNow());
 
-    return bx;
+    return bb.finish();
 }
 
-block *restore_block(uint32_t time, uint32_t crc, uint16_t n_pack,
-                     uint16_t n_tran, uint32_t n, uint64_t key,
-                     pack **packs)
+/* Carve the columns of n packs and their string heap out of one
+ * region, from the arena if given or from malloc otherwise */
+static uint32_t colsSize(uint16_t n, uint32_t heapLen)
 {
-    block *bx = (block *)malloc(sizeof(block));
-    if (bx == NULL){
+    return sizeof(blockCols) + ARENA_ALIGN
+        + n * (sizeof(uint64_t) + sizeof(uint32_t) + sizeof(infohash)
+               + 6 + sizeof(uint8_t))
+        + 2 * (n + 1) * sizeof(uint32_t) + heapLen;
+}
+
+static blockCols *colsCarve(arena *ar, uint16_t n, uint32_t heapLen)
+{
+    uint32_t size = colsSize(n, heapLen);
+    char *p = ar ? (char *)arenaAlloc(ar, size) : (char *)memAlloc(MEM_BLOCK, size);
+    if (p == NULL) {
         log_msg_default;
         return NULL;
     }
-    bx->time = time;
-    bx->crc = crc;
-    bx->nPack = n_pack;
-    bx->nTran = n_tran;
-    bx->n = n;
-    bx->key = key;
-    if (n_pack < MAX_U16) {
-        bx->nPack = n_pack;
-        bx->packs = packs;
-    } else {
-        bx->nPack = MAX_U16;
-        for (uint32_t i = MAX_U16; i < n_pack; i++) {
-            free(packs[i]);
+
+    // widest types first so everything stays aligned
+    blockCols *c = (blockCols *)p;
+    p += (sizeof(blockCols) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    c->n = n;
+    c->heapLen = heapLen;
+    c->xl = (uint64_t *)p;     p += n * sizeof(uint64_t);
+    c->tr = (uint32_t *)p;     p += n * sizeof(uint32_t);
+    c->dnOff = (uint32_t *)p;  p += (n + 1) * sizeof(uint32_t);
+    c->xtOff = (uint32_t *)p;  p += (n + 1) * sizeof(uint32_t);
+    c->hash = (infohash *)p;   p += n * sizeof(infohash);
+    c->info = (char (*)[6])p;  p += n * 6;
+    c->xtType = (uint8_t *)p;  p += n * sizeof(uint8_t);
+    c->heap = p;
+    return c;
+}
+
+/* Fill columns from an array of packs, c must be carved for them */
+static void colsFill(blockCols *c, pack **packs)
+{
+    uint32_t i, off = 0, len;
+    for (i = 0; i < c->n; i++) {
+        pack *px = packs[i];
+        c->xl[i] = px ? px->xl : 0;
+        c->tr[i] = px ? px->tr : MAX_U32;
+        c->xtType[i] = px ? px->xtType : XT_STR;
+        memcpy(c->info[i], px ? px->info : "\0\0\0\0\0", 6);
+        if (px && px->xtType != XT_STR)
+            c->hash[i] = px->xt.hash;
+        else
+            memset(&c->hash[i], 0, sizeof(infohash));
+
+        c->dnOff[i] = off;
+        len = px && px->dn ? strlen(px->dn) : 0;
+        memcpy(c->heap + off, px && px->dn ? px->dn : "", len + 1);
+        off += len + 1;
+    }
+    c->dnOff[i] = off;
+    for (i = 0; i < c->n; i++) {
+        pack *px = packs[i];
+        c->xtOff[i] = off;
+        if (px && px->xtType == XT_STR && px->xt.str) {
+            len = strlen(px->xt.str) + 1;
+            memcpy(c->heap + off, px->xt.str, len);
+            off += len;
         }
-        bx->packs = (pack **)realloc(packs, sizeof(pack *) * MAX_U16);
     }
+    c->xtOff[i] = off;
+}
+
+/* Bytes of heap needed for the strings of packs */
+static uint32_t colsHeapLen(pack **packs, uint16_t n)
+{
+    uint32_t len = 0;
+    for (uint16_t i = 0; i < n; i++) {
+        if (packs[i] == NULL)
+            len += 1;
+        else {
+            len += (packs[i]->dn ? strlen(packs[i]->dn) : 0) + 1;
+            if (packs[i]->xtType == XT_STR && packs[i]->xt.str)
+                len += strlen(packs[i]->xt.str) + 1;
+        }
+    }
+    return len;
+}
+
+blockCols *blockColumns(block *bx)
+{
+    if (bx->cols == NULL)
+        blockPacks(bx);
+    if (bx->cols != NULL || bx->packs == NULL)
+        return bx->cols;
+    arena *ar = bx->mem.head ? &bx->mem : NULL;
+    blockCols *c = colsCarve(ar, bx->nPack, colsHeapLen(bx->packs, bx->nPack));
+    if (c == NULL)
+        return NULL;
+    colsFill(c, bx->packs);
+    bx->cols = c;
+    return c;
+}
+
+pack **blockPacks(block *bx)
+{
+    pack **packs = __atomic_load_n(&bx->packs, __ATOMIC_ACQUIRE);
+    if (packs != NULL || bx->src == NULL)
+        return packs;
+
+    /* racing first uses each decode, one copy is kept and the others
+     * are dropped, readers never wait on a lock */
+    pack **mine = bx->src->load(bx->src->ctx, bx->lazy, bx->nPack);
+    if (mine == NULL)
+        return NULL;
+    if (!__atomic_compare_exchange_n(&bx->packs, &packs, mine, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        memFree(MEM_BLOCK, mine);
+        return packs;
+    }
+    return mine;
+}
+
+pack *blockPack(block *bx, uint16_t i)
+{
+    if (i >= bx->nPack)
+        return NULL;
+    pack **all = blockPacks(bx);
+    if (all != NULL)
+        return all[i];
+    if (bx->cols == NULL || bx->mem.head == NULL)
+        return NULL;
+
+    /* columnar only block, give it pack views into the heap */
+    blockCols *c = bx->cols;
+    pack **packs = (pack **)arenaAlloc(&bx->mem, sizeof(pack *) * c->n);
+    pack *px = (pack *)arenaAlloc(&bx->mem, sizeof(pack) * c->n);
+    if (packs == NULL || px == NULL)
+        return NULL;
+    for (uint16_t j = 0; j < c->n; j++) {
+        memcpy(px[j].info, c->info[j], 6);
+        px[j].xtType = c->xtType[j];
+        px[j].tr = c->tr[j];
+        px[j].dn = c->heap + c->dnOff[j];
+        px[j].xl = c->xl[j];
+        if (c->xtType[j] == XT_STR)
+            px[j].xt.str = c->heap + c->xtOff[j];
+        else
+            px[j].xt.hash = c->hash[j];
+        packs[j] = &px[j];
+    }
+    bx->packs = packs;
+    return packs[i];
+}
+
+block *blockCompact(block *bx)
+{
+    arena ar;
+    arenaInit(&ar);
+    if (bx->cols == NULL && blockPacks(bx) == NULL && bx->nPack)
+        return NULL;
+    uint32_t heapLen = bx->cols ? bx->cols->heapLen
+        : colsHeapLen(bx->packs, bx->nPack);
+    if (!arenaReserve(&ar, sizeof(block) + ARENA_ALIGN
+                      + colsSize(bx->nPack, heapLen)))
+        return NULL;
+
+    block *cx = (block *)arenaAlloc(&ar, sizeof(block));
+    blockCols *c = colsCarve(&ar, bx->nPack, heapLen);
+    if (c == NULL) {
+        arenaRelease(&ar);
+        return NULL;
+    }
+    if (bx->cols) {
+        /* same layout, only the pointers differ */
+        blockCols *o = bx->cols;
+        memcpy(c->xl, o->xl, (char *)(o->heap + heapLen) - (char *)o->xl);
+    } else {
+        colsFill(c, bx->packs);
+    }
+
+    *cx = *bx;
+    cx->packs = NULL;
+    cx->cols = c;
+    cx->mem = ar;
+    cx->src = NULL;
+    cx->lazy = NULL;
+    bx->trans = NULL; // moved to cx
     bx->nTran = 0;
-    bx->trans = NULL;
-    return bx;
+    deleteBlock(bx);
+    return cx;
+}
+
+block *restore_block(uint32_t time, uint32_t crc, uint16_t n_pack,
+                     uint16_t n_tran, uint32_t n, uint64_t key,
+                     pack **packs)
+{
+    BlockBuilder bb(n, key, n_pack, packsStrBytes(n_pack, packs));
+    bb.setTime(time);
+    bb.setCrc(crc);
+    if (!adoptPacks(bb, n_pack, packs))
+        return NULL;
+    return bb.finish();
 }
 
 chain *newChain(void)
 {
-    chain *ch = (chain *)malloc(sizeof(chain));
+    chain *ch = (chain *)memAlloc(MEM_CHAIN, sizeof(chain));
     if (ch == NULL) {
         log_msg_default;
 	return NULL;
     }
     
     ch->size = 0;
-    ch->head = NULL;
+    ch->reserved = 0;
+    ch->seg = NULL;
+    ch->nSeg = 0;
+    ch->capSeg = 0;
+    ch->retired = NULL;
+    ch->nRetired = 0;
+    pthread_mutex_init(&ch->lock, NULL);
+    strtabInit(&ch->trackers);
     return ch;
 }
 
+/* Add one segment to the directory, growing the top level table if it
+ * is full. Caller holds ch->lock. */
+static bool chainAddSeg(chain *ch)
+{
+    if (ch->nSeg == ch->capSeg) {
+        /* readers may still hold the old table, retire it instead of
+         * freeing it, the tables only add up to one more table's worth */
+        uint32_t cap = ch->capSeg ? ch->capSeg * 2 : 8;
+        block ***tmp = (block ***)memCalloc(MEM_CHAIN, cap, sizeof(block **));
+        block ****old = (block ****)memRealloc(MEM_CHAIN, ch->retired,
+                                               sizeof(block ***) * (ch->nRetired + 1));
+        if (tmp == NULL || old == NULL) {
+            log_msg_default;
+            memFree(MEM_CHAIN, tmp);
+            if (old)
+                ch->retired = old;
+            return 0;
+        }
+        ch->retired = old;
+        if (ch->seg != NULL) {
+            memcpy(tmp, ch->seg, sizeof(block **) * ch->nSeg);
+            ch->retired[ch->nRetired++] = ch->seg;
+        }
+        __atomic_store_n(&ch->seg, tmp, __ATOMIC_RELEASE);
+        ch->capSeg = cap;
+    }
+    block **sx = (block **)memCalloc(MEM_CHAIN, CHAIN_SEG_SIZE, sizeof(block *));
+    if (sx == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    __atomic_store_n(&ch->seg[ch->nSeg], sx, __ATOMIC_RELEASE);
+    ch->nSeg++;
+    return 1;
+}
+
+uint32_t chainReserve(chain *ch, uint32_t count)
+{
+    pthread_mutex_lock(&ch->lock);
+    uint32_t first = ch->reserved;
+    if (count == 0 || MAX_U32 - first < count) {
+        pthread_mutex_unlock(&ch->lock);
+        return MAX_U32;
+    }
+    // segments exist for every reserved number before it is handed out
+    uint64_t end = (uint64_t)first + count;
+    while (((uint64_t)ch->nSeg << CHAIN_SEG_SHIFT) < end) {
+        if (!chainAddSeg(ch)) {
+            pthread_mutex_unlock(&ch->lock);
+            return MAX_U32;
+        }
+    }
+    __atomic_store_n(&ch->reserved, (uint32_t)end, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ch->lock);
+    return first;
+}
+
+bool chainPublish(chain *ch, uint32_t i, block *bx)
+{
+    if (bx == NULL) {
+        log_msg_custom("Publishing no block, use chainAbandon");
+        return 0;
+    }
+    if (bx->crc == 0)
+        bx->crc = blockCrc(bx, &ch->trackers);
+
+    block ***seg = __atomic_load_n(&ch->seg, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&seg[i >> CHAIN_SEG_SHIFT][i & CHAIN_SEG_MASK], bx,
+                     __ATOMIC_SEQ_CST);
+
+    /* push size over every published block after it, whoever publishes
+     * the block size is waiting on carries it over the ones after, the
+     * seq_cst ops make sure one of the two publishers sees the other */
+    uint32_t s = __atomic_load_n(&ch->size, __ATOMIC_SEQ_CST);
+    while (s < __atomic_load_n(&ch->reserved, __ATOMIC_SEQ_CST)) {
+        seg = __atomic_load_n(&ch->seg, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seg[s >> CHAIN_SEG_SHIFT][s & CHAIN_SEG_MASK],
+                            __ATOMIC_SEQ_CST) == NULL)
+            break;
+        if (__atomic_compare_exchange_n(&ch->size, &s, s + 1, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            s++;
+    }
+    __atomic_store_n(&ch->time, (uint32_t)sNow(), __ATOMIC_RELAXED);
+    return 1;
+}
+
+bool chainAbandon(chain *ch, uint32_t i)
+{
+    // a real block, readers below chainSize never see a hole
+    BlockBuilder bb(i, 0, 0);
+    block *bx = bb.finish();
+    if (bx == NULL) {
+        log_msg_custom("No memory to abandon a block number");
+        return 0;
+    }
+    return chainPublish(ch, i, bx);
+}
+
 //! return 1 on success
 bool insertBlock(block *bx, chain *ch)
 {
     if (bx == NULL) return 0;
-    block **tmp = (block **)realloc(ch->head, sizeof(block *) * (ch->size + 1));
 
-    // if realloc was successfull assign to head
-    if (tmp != NULL)
-        ch->head = tmp;
-    else {
-        log_msg_default;
+    uint32_t i = chainReserve(ch, 1);
+    if (i == MAX_U32) {
+        log_msg_custom("Failed to reserve a block number");
         return 0;
     }
-    
-    ch->head[ch->size] = bx;//! Don't free block pointer
-    ch->size++;
-    ch->time = (uint32_t)sNow();
+    chainPublish(ch, i, bx);//! Don't free block pointer
     return true;
 }
 
+bool chainAppend(chain *ch, chain *from)
+{
+    uint32_t size = chainSize(from), nTr = from->trackers.n;
+    if (size == 0)
+        return 1;
+
+    uint32_t *map = (uint32_t *)memAlloc(MEM_CHAIN, sizeof(uint32_t)
+                                         * (nTr ? nTr : 1));
+    if (map == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    for (uint32_t i = 0; i < nTr; i++) {
+        map[i] = strtabIntern(&ch->trackers, from->trackers.ent[i].str,
+                              from->trackers.ent[i].len);
+        if (map[i] == STRTAB_NONE) {
+            memFree(MEM_CHAIN, map);
+            return 0;
+        }
+    }
+    uint32_t first = chainReserve(ch, size);
+    if (first == MAX_U32) {
+        log_msg_custom("Failed to reserve a block number");
+        memFree(MEM_CHAIN, map);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        block **slot = &from->seg[i >> CHAIN_SEG_SHIFT][i & CHAIN_SEG_MASK];
+        block *bx = *slot;
+        // lazy packs hold ids of this table, decode them now or never
+        if (bx->src && bx->nPack && blockPacks(bx) == NULL) {
+            log_msg_custom("Decoding a block to append failed");
+            for (uint32_t k = i; k < size; k++) {
+                chainAbandon(ch, first + k);
+                // what is left moves to the front of from
+                from->seg[(k - i) >> CHAIN_SEG_SHIFT][(k - i) & CHAIN_SEG_MASK]
+                    = from->seg[k >> CHAIN_SEG_SHIFT][k & CHAIN_SEG_MASK];
+            }
+            from->size = from->reserved = size - i;
+            memFree(MEM_CHAIN, map);
+            return 0;
+        }
+        for (uint16_t j = 0; bx->packs && j < bx->nPack; j++)
+            if (bx->packs[j]->tr < nTr)
+                bx->packs[j]->tr = map[bx->packs[j]->tr];
+        for (uint16_t j = 0; bx->cols && j < bx->nPack; j++)
+            if (bx->cols->tr[j] < nTr)
+                bx->cols->tr[j] = map[bx->cols->tr[j]];
+        chainPublish(ch, first + i, bx);
+        *slot = NULL;
+    }
+    from->size = from->reserved = 0;
+    memFree(MEM_CHAIN, map);
+    return 1;
+}
+
+/* blockCrc feeds crc32c in large runs, small fields are gathered here */
+typedef struct
+{
+    uint32_t crc;
+    uint32_t len;
+    uint8_t  buf[4096];
+}crcAcc;
+
+static inline void crcFlush(crcAcc *a)
+{
+    a->crc = crc32c(a->crc, a->buf, a->len);
+    a->len = 0;
+}
+
+static inline void crcAdd(crcAcc *a, const void *data, size_t len)
+{
+    if (len > sizeof(a->buf) - a->len) {
+        crcFlush(a);
+        if (len > sizeof(a->buf)) {
+            a->crc = crc32c(a->crc, data, len);
+            return;
+        }
+    }
+    if (len) // data may be NULL when len is 0
+        memcpy(a->buf + a->len, data, len);
+    a->len += len;
+}
+
+//! Little endian store
+static inline void crcPut(crcAcc *a, uint64_t v, int len)
+{
+    if (len > (int)(sizeof(a->buf) - a->len))
+        crcFlush(a);
+    for (int i = 0; i < len; i++)
+        a->buf[a->len++] = (uint8_t)(v >> (8 * i));
+}
+
+uint32_t blockCrc(block *bx, const strtab *trackers)
+{
+    crcAcc a;
+    a.crc = 0;
+    a.len = 0;
+
+    crcPut(&a, bx->n, 4);
+    crcPut(&a, bx->time, 4);
+    crcPut(&a, bx->nPack, 2);
+    crcPut(&a, bx->nTran, 2);
+    crcPut(&a, bx->key, 8);
+
+    for (uint16_t i = 0; i < bx->nPack; i++) {
+        pack *pk = blockPack(bx, i);
+        if (pk == NULL)
+            continue;
+        const char *url = strtabGet(trackers, pk->tr);
+        size_t dnLen = pk->dn ? strlen(pk->dn) : 0;
+        size_t urlLen = url ? strlen(url) : 0;
+        // BlockBuilder keeps both strings in PACK_STR_MAX, urls fit a u16
+        dnLen = dnLen > PACK_STR_MAX ? PACK_STR_MAX : dnLen;
+        urlLen = urlLen > MAX_U16 ? MAX_U16 : urlLen;
+
+        crcPut(&a, dnLen, 2);
+        crcAdd(&a, pk->dn, dnLen);
+        crcPut(&a, pk->xl, 8);
+        crcPut(&a, urlLen, 2);
+        crcAdd(&a, url, urlLen);
+        crcPut(&a, pk->xtType, 1);
+        if (pk->xtType != XT_STR) {
+            crcAdd(&a, pk->xt.hash.b, sizeof(pk->xt.hash.b));
+        } else {
+            size_t len = pk->xt.str ? strlen(pk->xt.str) : 0;
+            len = len > PACK_STR_MAX ? PACK_STR_MAX : len;
+            crcPut(&a, len, 2);
+            crcAdd(&a, pk->xt.str, len);
+        }
+    }
+    for (uint16_t i = 0; i < bx->nTran && bx->trans; i++) {
+        tran *tx = bx->trans[i];
+        crcPut(&a, tx->time, 4);
+        crcPut(&a, tx->id, 4);
+        crcPut(&a, tx->src, 8);
+        crcPut(&a, tx->dest, 8);
+        crcPut(&a, tx->amount, 8);
+        crcPut(&a, tx->key, 8);
+    }
+    crcFlush(&a);
+    return a.crc;
+}
+
+#define VERIFY_RUN 64 // blocks a chainVerify task takes at a time
+
+/* Arguments of a chainVerify task */
+typedef struct
+{
+    chain    *ch;
+    uint32_t *next;  // next block to take, shared
+    uint32_t  end;
+    uint32_t  bad;
+}verifyWork;
+
+static void *verifyWorker(void *args)
+{
+    verifyWork *vw = (verifyWork *)args;
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(vw->next, VERIFY_RUN, __ATOMIC_RELAXED))
+           < vw->end) {
+        uint32_t end = vw->end - i < VERIFY_RUN ? vw->end : i + VERIFY_RUN;
+        for (; i < end; i++) {
+            block *bx = chainBlock(vw->ch, i);
+            if (blockCrc(bx, &vw->ch->trackers) != bx->crc) {
+                char msg[64];
+                snprintf(msg, sizeof(msg), "Block %u fails its crc", bx->n);
+                log_msg_custom(msg);
+                vw->bad++;
+            }
+        }
+    }
+    return NULL;
+}
+
+uint32_t chainVerify(chain *ch, uint32_t start, uint32_t end, uint8_t threads)
+{
+    if (threads == 0)
+        threads = 1;
+    if (end > chainSize(ch))
+        end = chainSize(ch);
+
+    uint32_t next = start, bad = 0, i;
+    verifyWork vw[threads];
+    poolGroup g;
+    poolGroupInit(&g);
+    for (i = 0; i < threads; i++) {
+        vw[i].ch = ch;
+        vw[i].next = &next;
+        vw[i].end = end;
+        vw[i].bad = 0;
+    }
+    // the calling thread is the last worker
+    for (i = 0; i < threads - 1u; i++)
+        poolSubmit(&g, verifyWorker, &vw[i]);
+    verifyWorker(&vw[threads - 1]);
+    poolWait(&g);
+    for (i = 0; i < threads; i++)
+        bad += vw[i].bad;
+    return bad;
+}
+
 uint32_t deletePack(pack *target)
 {
     uint32_t bytesFreed = sizeof(pack);
     
     if (target->dn != NULL) {
         bytesFreed += strlen(target->dn) + 1;
-        free(target->dn);
+        memFree(MEM_BLOCK, target->dn);
     }
     
-    if (target->xt != NULL) {
-        bytesFreed += strlen(target->xt) + 1;
-        free(target->xt);
-    }
-    
-    if (target->tr != NULL) {
-        bytesFreed += strlen(target->tr) + 1;
-        free(target->tr);
+    if (target->xtType == XT_STR && target->xt.str != NULL) {
+        bytesFreed += strlen(target->xt.str) + 1;
+        memFree(MEM_BLOCK, target->xt.str);
     }
     
     return bytesFreed;
@@ -208,35 +706,76 @@ uint32_t deletePack(pack *target)
 uint32_t deleteBlock(block *target)
 {
     uint32_t i, bytesFreed = sizeof(block);
-    if (target->packs != NULL && target->nPack > 0) {
-        for (i = 0; i < target->nPack; i++) {
-            bytesFreed += deletePack(target->packs[i]) + sizeof(pack *);
-            free(target->packs[i]);
-        }
-        free(target->packs);
-    }
 
     if (target->trans != NULL && target->nTran > 0) {
         for (i = 0; i < target->nTran; i++) {
             if (target->trans[i] != NULL) {
                 bytesFreed += sizeof(tran *);
-                free(target->trans[i]);
+                memFree(MEM_BLOCK, target->trans[i]);
             }
         }
-        free(target->trans);
+        memFree(MEM_BLOCK, target->trans);
+    }
+
+    /* arena blocks live inside their own arena */
+    if (target->mem.head != NULL)
+        return bytesFreed - sizeof(block) + arenaRelease(&target->mem);
+
+    /* blocks loaded header only hold their packs in one allocation */
+    if (target->src != NULL) {
+        memFree(MEM_BLOCK, target->packs);
+        memFree(MEM_BLOCK, target->cols);
+        memFree(MEM_BLOCK, target);
+        return bytesFreed;
+    }
+
+    if (target->packs != NULL && target->nPack > 0) {
+        for (i = 0; i < target->nPack; i++) {
+            bytesFreed += deletePack(target->packs[i]) + sizeof(pack *);
+            memFree(MEM_BLOCK, target->packs[i]);
+        }
+        memFree(MEM_BLOCK, target->packs);
     }
 
+    memFree(MEM_BLOCK, target->cols);
+
+    memFree(MEM_BLOCK, target);
     return bytesFreed;
 }
 
+bool chainColumnize(chain *ch)
+{
+    for (uint32_t i = 0; i < ch->size; i++) {
+        block **slot = &ch->seg[i >> CHAIN_SEG_SHIFT][i & CHAIN_SEG_MASK];
+        if ((*slot)->packs == NULL && (*slot)->src == NULL)
+            continue; // already columnar
+        block *cx = blockCompact(*slot);
+        if (cx == NULL)
+            return 0;
+        *slot = cx;
+    }
+    return 1;
+}
+
 uint32_t deleteChain(chain *target)
 {
     uint32_t bytesFreed = 0;
     for (uint32_t i = 0; i < target->size; i++) {
-        bytesFreed += deleteBlock(target->head[i]) + sizeof(block *);
-        free(target->head[i]);
+        bytesFreed += deleteBlock(chainBlock(target, i)) + sizeof(block *);
     }
     
-    free(target->head);
+    for (uint32_t i = 0; i < target->nSeg; i++) {
+        memFree(MEM_CHAIN, target->seg[i]);
+    }
+    memFree(MEM_CHAIN, target->seg);
+    for (uint32_t i = 0; i < target->nRetired; i++) {
+        memFree(MEM_CHAIN, target->retired[i]);
+    }
+    memFree(MEM_CHAIN, target->retired);
+    pthread_mutex_destroy(&target->lock);
+    bytesFreed += strtabFree(&target->trackers);
+    bytesFreed += sizeof(block **) * target->capSeg
+        + sizeof(block *) * CHAIN_SEG_SIZE * target->nSeg
+        - sizeof(block *) * target->size;
     return bytesFreed;
 }
@@ -7,20 +7,33 @@
 #include "alib.h"
 #include "log.h"
 #include "alibio.h"
+#include "strtab.h"
+#include "infohash.h"
+#include "blockbuilder.h"
+#include "chainbin.h"
+#include "chainframe.h"
+#include "textparse.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "time_fn.h"
+#include "memstat.h"
 #include "lzma_wrapper.h"
 #include "C/LzmaEnc.h"
 
 void packToText(pack *pk, FILE *fp, char *buf, int len)
 {
     //2 tabs
+    char xtBuf[XT_BTIH_MAX];
+    const char *xt;
     if (!pk || !fp || !buf) return;
+    xtFormat(pk, xtBuf, &xt);
     snprintf(buf, len, "\t{P\
 \n\t\tPinfo: %s,\
 \n\t\tPdn  : %s,\
 \n\t\tPlen : %lld,\
 \n\t\tPxt  : %s,\
-\n\t\tPtr  : %s,\
-\n\tP},\n", pk->info, pk->dn, pk->xl, pk->xt, pk->tr);
+\n\t\tPtr  : %u,\
+\n\tP},\n", pk->info, pk->dn, pk->xl, xt, pk->tr);
 
     fwrite(buf, 1, strlen(buf), fp);
 }
@@ -57,7 +70,7 @@ void blockToText(block *bx, FILE *fp, char *buf, int len)
     fwrite(buf, 1, strlen(buf), fp);
     
     for (i = 0; i < bx->nPack; i++) {
-        packToText(bx->packs[i], fp, buf, len);
+        packToText(blockPack(bx, i), fp, buf, len);
     }
     for (i = 0; i < bx->nTran; i++) {
         tranToText(bx->trans[i], fp, buf, len);
@@ -67,47 +80,416 @@ void blockToText(block *bx, FILE *fp, char *buf, int len)
     fwrite(buf, 1, strlen(buf), fp);
 }
 
+/* The *ToBuf writers print exactly what the snprintf ones above do,
+ * the casts keep the signedness of their %d and %ld */
+void packToBuf(pack *pk, outBuf *ob)
+{
+    char xtBuf[XT_BTIH_MAX];
+    const char *xt;
+    if (!pk) return;
+    uint32_t xtLen = xtFormat(pk, xtBuf, &xt);
+
+    outBufLit(ob, "\t{P\n\t\tPinfo: ");
+    outBufStr(ob, pk->info);
+    outBufLit(ob, ",\n\t\tPdn  : ");
+    outBufStr(ob, pk->dn ? pk->dn : "(null)");
+    outBufLit(ob, ",\n\t\tPlen : ");
+    outBufI64(ob, (int64_t)pk->xl);
+    outBufLit(ob, ",\n\t\tPxt  : ");
+    outBufWrite(ob, xt, xtLen);
+    outBufLit(ob, ",\n\t\tPtr  : ");
+    outBufU64(ob, pk->tr);
+    outBufLit(ob, ",\n\tP},\n");
+}
+
+void tranToBuf(tran *tx, outBuf *ob)
+{
+    if (!tx) return;
+    outBufLit(ob, "\t{T\n\t\tTtime: ");
+    outBufI64(ob, (int32_t)tx->time);
+    outBufLit(ob, ",\n\t\tTid  : ");
+    outBufI64(ob, (int32_t)tx->id);
+    outBufLit(ob, ",\n\t\tTsrc : ");
+    outBufI64(ob, (int64_t)tx->src);
+    outBufLit(ob, ",\n\t\tTdest: ");
+    outBufI64(ob, (int64_t)tx->dest);
+    outBufLit(ob, ",\n\t\tTsum : ");
+    outBufI64(ob, (int64_t)tx->amount);
+    outBufLit(ob, ",\n\t\tTkey : ");
+    outBufI64(ob, (int64_t)tx->key);
+    outBufLit(ob, ",\n\t},\n");
+}
+
+void blockToBuf(block *bx, outBuf *ob)
+{
+    uint32_t i;
+    outBufLit(ob, "{B\n\tBgmt : ");
+    outBufI64(ob, (int32_t)bx->time);
+    outBufLit(ob, ",\n\tBcrc : ");
+    outBufI64(ob, (int32_t)bx->crc);
+    outBufLit(ob, ",\n\tBpack: ");
+    outBufU64(ob, bx->nPack);
+    outBufLit(ob, ",\n\tBtran: ");
+    outBufU64(ob, bx->nTran);
+    outBufLit(ob, ",\n\tBn   : ");
+    outBufI64(ob, (int32_t)bx->n);
+    outBufLit(ob, ",\n\tBkey : ");
+    outBufI64(ob, (int64_t)bx->key);
+    outBufLit(ob, ",\n");
+
+    for (i = 0; i < bx->nPack; i++) {
+        packToBuf(blockPack(bx, i), ob);
+    }
+    for (i = 0; i < bx->nTran; i++) {
+        tranToBuf(bx->trans[i], ob);
+    }
+    outBufLit(ob, "B},\n");
+}
+
+void partHeadText(chain *ch, uint32_t end, uint32_t part, outBuf *ob)
+{
+    uint32_t i, nDict = __atomic_load_n(&ch->trackers.n, __ATOMIC_ACQUIRE);
+
+    outBufLit(ob, "Ctime: ");
+    outBufU64(ob, part);
+    outBufLit(ob, ",\nCsize: ");
+    outBufU64(ob, end);
+    outBufLit(ob, ",\n");
+
+    // tracker dictionary, packs only print the ids
+    for (i = 0; i < nDict; i++) {
+        outBufLit(ob, "Cdict: ");
+        outBufU64(ob, i);
+        outBufPut8(ob, ' ');
+        outBufStr(ob, strtabGet(&ch->trackers, i));
+        outBufLit(ob, ",\n");
+    }
+}
+
+bool partToText(chain *ch, uint32_t start, uint32_t end, uint32_t part,
+                FILE *fp)
+{
+    outBuf ob;
+    uint32_t i;
+
+    if (!outBufInit(&ob, fp, OUTBUF_LARGE))
+        return 0;
+
+    partHeadText(ch, end, part, &ob);
+    for (i = start; i < end; ) {
+        uint32_t run, j;
+        block **bx = chainSpan(ch, i, end, &run);
+        for (j = 0; j < run; j++) {
+            blockToBuf(bx[j], &ob);
+        }
+        i += run;
+    }
+    
+    outBufLit(&ob, "EOF\n");
+    return outBufFree(&ob);
+}
+
+uint32_t partName(char *buf, uint32_t len, uint32_t part, uint8_t fmt)
+{
+    const char *name[] = {"temp%u.file", "temp%u.bin", "temp%u.tcf"};
+    return snprintf(buf, len, name[fmt <= CHAIN_FRAME ? fmt : CHAIN_TEXT],
+                    part);
+}
+
+/** @brief Room for the name of a part file */
+#define PART_PATH_MAX 256
+
+/* 1 if @p pattern holds exactly one integer conversion, %d %i or %u
+ * with an optional width, and no other */
+static bool partPatternOk(const char *pattern)
+{
+    uint32_t conv = 0;
+    for (const char *p = pattern; *p; p++) {
+        if (*p != '%')
+            continue;
+        if (*++p == '%')
+            continue;
+        while (*p == '0' || (*p >= '1' && *p <= '9'))
+            p++;
+        if (*p != 'd' && *p != 'i' && *p != 'u')
+            return 0;
+        conv++;
+    }
+    return conv == 1;
+}
+
+/* File of part @p part: @p pattern with the part number, or when it is
+ * NULL the name chainCompactor writes, partName plus .7z except for
+ * framed parts which are compressed frame by frame
+ *
+ * @return 0 - bad pattern or the name does not fit
+ */
+static bool partPath(char *buf, uint32_t len, const char *pattern,
+                     uint32_t part, uint8_t fmt)
+{
+    int n;
+    if (pattern == NULL) {
+        n = partName(buf, len, part, fmt);
+        if (fmt != CHAIN_FRAME && n >= 0 && (uint32_t)n < len)
+            n += snprintf(buf + n, len - n, ".7z");
+    } else if (partPatternOk(pattern)) {
+        n = snprintf(buf, len, pattern, part);
+    } else {
+        log_msg_custom("Part file pattern needs a single %u");
+        return 0;
+    }
+    return n >= 0 && (uint32_t)n < len;
+}
+
+/** @brief Bytes serialized at a time for the encoder */
+#define PART_STREAM_CHUNK (1U << 18)
+
+/* Pipeline between the serializer and the encoder of a part. Chunks
+ * are serialized into a ring of depth buffers by tasks of the thread
+ * pool while the encoder pulls the oldest one through an
+ * ISeqInStream. One serializer runs at a time, blocks go out in
+ * order. Nothing waits on a task that has not started: the encoder
+ * serializes the next chunk itself when the ring is empty and no
+ * serializer is running, so the pipeline also works on a single worker. */
+typedef struct
+{
+    ISeqInStream in;   // must be first, the encoder passes &in back
+    chain   *ch;
+    uint32_t next;     // next block to serialize
+    uint32_t end;      // one past the last block
+    uint8_t  fmt;      // ChainFormat
+    binBlock last;     // header of the last block serialized, CHAIN_BIN
+    outBuf  *buf;      // the ring, memory only
+    uint32_t depth;    // buffers in buf
+    uint32_t head;     // oldest serialized chunk
+    uint32_t count;    // serialized chunks, the one being read included
+    uint32_t pos;      // bytes of buf[head] already handed out
+    bool     done;     // the tail has been serialized
+    bool     busy;     // a chunk is being serialized
+    bool     queued;   // a serializer task is submitted and not over
+    bool     stop;     // the encoder is over, serializers quit
+    bool     err;      // a chunk failed to grow
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;  // a chunk was serialized
+    poolGroup g;           // the serializer tasks
+    partStat  st;          // stage counters
+}partPipe;
+
+/* Serialize the next chunk into the slot after the last full one.
+ * pp->lock is held on entry and on return, not while serializing.
+ * @return 0 if there was nothing to do */
+static bool pipeFill(partPipe *pp)
+{
+    if (pp->busy || pp->done || pp->stop || pp->count == pp->depth) {
+        if (pp->count == pp->depth)
+            pp->st.full++;
+        return 0;
+    }
+    pp->busy = 1;
+    outBuf *ob = &pp->buf[(pp->head + pp->count) % pp->depth];
+    pthread_mutex_unlock(&pp->lock);
+
+    uint64_t us = usNow();
+    // the fields below are only touched by the busy serializer
+    while (pp->next < pp->end && ob->len < PART_STREAM_CHUNK) {
+        uint32_t run, j;
+        block **bx = chainSpan(pp->ch, pp->next, pp->end, &run);
+        for (j = 0; j < run && ob->len < PART_STREAM_CHUNK; j++) {
+            if (pp->fmt == CHAIN_BIN)
+                blockToBin(bx[j], &pp->last, ob);
+            else
+                blockToBuf(bx[j], ob);
+        }
+        pp->next += j;
+    }
+    bool tail = pp->next == pp->end;
+    if (tail && pp->fmt == CHAIN_TEXT)
+        outBufLit(ob, "EOF\n");
+    us = usNow() - us;
+
+    pthread_mutex_lock(&pp->lock);
+    pp->st.serUs += us;
+    pp->err |= ob->err;
+    pp->done = tail;
+    pp->busy = 0;
+    pp->count++;
+    pthread_cond_broadcast(&pp->cond);
+    return 1;
+}
+
+/* Serializer task, fills chunks until the ring is full */
+static void *pipeWorker(void *args)
+{
+    partPipe *pp = (partPipe *)args;
+    pthread_mutex_lock(&pp->lock);
+    while (pipeFill(pp))
+        ;
+    pp->queued = 0;
+    pthread_mutex_unlock(&pp->lock);
+    return NULL;
+}
+
+/* Submit a serializer if there is room and none is around, pp->lock
+ * held */
+static void pipeKick(partPipe *pp)
+{
+    if (pp->queued || pp->busy || pp->done || pp->stop
+        || pp->count == pp->depth)
+        return;
+    pp->queued = 1;
+    // may run pipeWorker inline, which takes the lock
+    pthread_mutex_unlock(&pp->lock);
+    poolSubmit(&pp->g, pipeWorker, pp);
+    pthread_mutex_lock(&pp->lock);
+}
+
+static SRes pipeRead(void *p, void *buf, size_t *size)
+{
+    partPipe *pp = (partPipe *)p;
+    size_t got = 0;
+    pthread_mutex_lock(&pp->lock);
+    while (got == 0 && !pp->err) {
+        if (pp->count == 0) {
+            if (pp->done)
+                break; // the end of the stream
+            uint64_t us = usNow();
+            if (pipeFill(pp)) {
+                // serialized here, not time spent encoding
+                pp->st.waitUs += usNow() - us;
+            } else {
+                // a running serializer signals when its chunk is out
+                pthread_cond_wait(&pp->cond, &pp->lock);
+                pp->st.waitUs += usNow() - us;
+            }
+            continue;
+        }
+        pipeKick(pp);
+
+        // serializers only write after the full chunks, buf[head] is ours
+        outBuf *ob = &pp->buf[pp->head];
+        pthread_mutex_unlock(&pp->lock);
+        got = ob->len - pp->pos;
+        if (got > *size)
+            got = *size;
+        memcpy(buf, ob->buf + pp->pos, got);
+        pp->pos += got;
+        pthread_mutex_lock(&pp->lock);
+        if (pp->pos == ob->len) {
+            ob->len = 0;
+            pp->pos = 0;
+            pp->head = (pp->head + 1) % pp->depth;
+            pp->count--;
+            pipeKick(pp);
+        }
+    }
+    pp->st.raw += got;
+    bool err = pp->err;
+    pthread_mutex_unlock(&pp->lock);
+    *size = got;
+    return err ? SZ_ERROR_MEM : SZ_OK;
+}
+
+bool partToLzma(chain *ch, uint32_t start, uint32_t end, uint32_t part,
+                uint8_t fmt, FILE *fp, uint8_t depth, partStat *stat)
+{
+    partPipe pp;
+    uint32_t i;
+    memset(&pp, 0, sizeof(pp));
+    pp.in.Read = pipeRead;
+    pp.ch = ch;
+    pp.next = start;
+    pp.end = end;
+    pp.fmt = fmt;
+    pp.depth = depth ? depth : 1;
+    binBlockStart(&pp.last);
+    poolGroupInit(&pp.g);
+
+    pp.buf = (outBuf *)memAlloc(MEM_IO, sizeof(outBuf) * pp.depth);
+    for (i = 0; pp.buf && i < pp.depth; i++)
+        if (!outBufInit(&pp.buf[i], NULL, PART_STREAM_CHUNK + OUTBUF_SIZE))
+            break;
+    if (i < pp.depth) {
+        log_msg_default;
+        while (i > 0)
+            outBufFree(&pp.buf[--i]);
+        memFree(MEM_IO, pp.buf);
+        return 0;
+    }
+    pthread_mutex_init(&pp.lock, NULL);
+    pthread_cond_init(&pp.cond, NULL);
+
+    // the header goes out with the first chunk
+    if (fmt == CHAIN_BIN)
+        partHeadBin(ch, end - start, part, &pp.buf[0]);
+    else
+        partHeadText(ch, end, part, &pp.buf[0]);
+    if (start == end && fmt == CHAIN_BIN) {
+        pp.done = 1;
+        pp.count = 1;
+    }
+
+    uint64_t us = usNow();
+    bool ok = compress_stream(&pp.in, fp);
+    us = usNow() - us;
+
+    pthread_mutex_lock(&pp.lock);
+    pp.stop = 1;
+    pthread_mutex_unlock(&pp.lock);
+    poolWait(&pp.g);
+    ok = ok && !pp.err;
+
+    if (stat) {
+        stat->raw = pp.st.raw;
+        stat->serUs = pp.st.serUs;
+        stat->waitUs = pp.st.waitUs;
+        stat->encUs = us > pp.st.waitUs ? us - pp.st.waitUs : 0;
+        stat->full = pp.st.full;
+    }
+    pthread_cond_destroy(&pp.cond);
+    pthread_mutex_destroy(&pp.lock);
+    for (i = 0; i < pp.depth; i++)
+        outBufFree(&pp.buf[i]);
+    memFree(MEM_IO, pp.buf);
+    return ok;
+}
+
 void *blockToText(void *args)
 {
     threadParams *tp = (threadParams *)args;
     uint8_t part =      tp->i;
-    block **head =      tp->head;
+    chain *ch =         tp->ch;
     uint32_t start =    tp->start;
     uint32_t target =   tp->end;
     //1 tab
-    char tmp[16];
-    snprintf(tmp, 15, "temp%u.file", part);
-    FILE *fp = fopen(tmp, "w");
+    char tmp[PART_PATH_MAX];
+    partPath(tmp, sizeof(tmp), NULL, part, tp->fmt);
+    FILE *fp = fopen(tmp, "wb");
     
-    uint32_t i;
-    int len = 3000;
-
-    char *buf = (char *)malloc(sizeof(char) * (len + 1));
-    // char buf[3001];
-    if (buf == NULL || fp == NULL) {
+    tp->ok = 0;
+    if (fp == NULL) {
         char msg[80];
         snprintf(msg, 79, "\nCreating part [%u] failed, name [%s], pointer [%p][%d]\n",
                 part, tmp, fp, fp);
         log_msg_custom(msg);
         return NULL;
     }
-    
-    snprintf(buf, len, "Ctime: %u,\nCsize: %u,\n", part, target);
-    
-    fwrite(buf, 1, strlen(buf), fp);
-    
-    for (i = start; i < target; i++) {
-        blockToText(head[i], fp, buf, len);
+
+    uint32_t ms = msNow();
+    bool ok;
+    if (tp->fmt == CHAIN_FRAME)
+        ok = partToFrames(ch, start, target, part, fp);
+    else // serialized straight into the encoder, no plain text file
+        ok = partToLzma(ch, start, target, part, tp->fmt, fp, tp->depth,
+                        tp->stat);
+    if (!ok)
+        log_msg_custom("Writing a chain part failed");
+    if (tp->stat) {
+        long at = ftell(fp);
+        tp->stat->bytes = at > 0 ? at : 0;
+        tp->stat->ms = msNow() - ms;
     }
     
-    strcpy(buf, "EOF\n");
-    fwrite(buf, 1, strlen(buf), fp);
-    
-    fclose(fp);
-    free(buf);
-    
-    compress_file(tmp);
-    
+    tp->ok = fclose(fp) == 0 && ok;
     return NULL;
 }
 
@@ -116,9 +498,12 @@ void *chainToText(chain *ch, uint8_t parts)
 {
     threadParams tp;
     tp.i = parts;
-    tp.head = ch->head;
+    tp.ch = ch;
     tp.start = 0;
-    tp.end = ch->size;
+    tp.end = chainSize(ch);
+    tp.fmt = CHAIN_TEXT;
+    tp.stat = NULL;
+    tp.depth = PART_PIPE_DEPTH;
 
     return blockToText(&tp);
 }
@@ -178,27 +563,117 @@ char *indexes_of(char *haystack, const char *needle_start,
     if (! (ptr_start && ptr_end))
         return NULL;
     
-    int len = ptr_end - ptr_start + 2;
-    char *dest = (char *)malloc(sizeof(char)* len + 1); 
+    int len = ptr_end - ptr_start - 2;
+    if (len < 0)
+        return NULL;
+    char *dest = (char *)memAlloc(MEM_PARSER, sizeof(char)* len + 1); 
     dest[len] = '\0';
     memcpy(dest, ptr_start + 2, len);
     return dest;
 }
 
-pack *text2Pac(FILE *fp)
+/* Tracker ids of the file being read -> ids in the chain's table */
+typedef struct
+{
+    uint32_t *id;
+    uint32_t  n;
+}trackerMap;
+
+/* Add a "Cdict: <id> <url>," line to the map */
+static void trackerMapAdd(trackerMap *map, char *data, chain *ch)
+{
+    char *url, *end, *val = strstr(data, ": ");
+    if (val == NULL)
+        return;
+    unsigned long v = strtoul(val + 2, &url, 10);
+    end = strrchr(url, ',');
+    if (*url != ' ' || end == NULL || v >= STRTAB_NONE)
+        return;
+    uint32_t id = v;
+    url++;
+
+    if (id >= map->n) {
+        // doubled, partHeadText writes the ids in order
+        uint32_t n = map->n < id / 2 + 1 ? id + 1
+            : map->n < STRTAB_NONE / 2 ? map->n * 2 : STRTAB_NONE;
+        uint32_t *tmp = (uint32_t *)memRealloc(MEM_PARSER, map->id,
+                                               sizeof(uint32_t) * (size_t)n);
+        if (tmp == NULL) {
+            log_msg_default;
+            return;
+        }
+        for (uint32_t i = map->n; i < n; i++)
+            tmp[i] = STRTAB_NONE;
+        map->id = tmp;
+        map->n = n;
+    }
+    map->id[id] = strtabIntern(&ch->trackers, url, end - url);
+}
+
+/* Resolve a Ptr value, a dictionary id or a raw url from older files */
+static uint32_t trackerMapGet(trackerMap *map, char *val, chain *ch)
+{
+    char *end;
+    uint32_t id = strtoul(val, &end, 10);
+    if (end != val && *end == ',')
+        return id < map->n ? map->id[id] : STRTAB_NONE;
+    end = strrchr(val, ',');
+    return strtabIntern(&ch->trackers, val, end ? end - val : strlen(val));
+}
+
+/* fgets a whole line, one longer than s continues in *big, grown as
+ * needed, so names up to PACK_STR_MAX are not cut
+ *
+ * @return the line, s or *big, NULL at the end of the file
+ */
+static char *lineGet(FILE *fp, char *s, int len, char **big, uint32_t *cap)
+{
+    if (fgets(s, len, fp) == NULL)
+        return NULL;
+    uint32_t n = strlen(s);
+    if (n == 0 || s[n - 1] == '\n' || feof(fp))
+        return s;
+
+    for (char *at = s; ; at = *big) {
+        if (*cap < n + len) {
+            uint32_t size = *cap ? *cap * 2 : 4 * len;
+            char *tmp = (char *)memRealloc(MEM_PARSER, *big, size);
+            if (tmp == NULL) {
+                log_msg_default;
+                return at; // cut, the line fails to parse
+            }
+            *big = tmp;
+            *cap = size;
+        }
+        if (at == s)
+            memcpy(*big, s, n + 1);
+        if (fgets(*big + n, len, fp) == NULL)
+            return *big;
+        n += strlen(*big + n);
+        if ((*big)[n - 1] == '\n')
+            return *big;
+    }
+}
+
+/* Add the pack after a {P line to bb, straight into the block's arena
+ *
+ * @return 0 on a truncated pack or if bb refused it
+ */
+bool text2Pac(FILE *fp, chain *ch, trackerMap *map, BlockBuilder &bb)
 {
     char s[MAX_U8 + 1],
+        *line,
+        *big = NULL,
         *dn = NULL,
         *xt = NULL,
         *p_xl = NULL,
-        *tr = NULL;
+        *p_tr = NULL;
     uint64_t xl = 0;
+    uint32_t tr = STRTAB_NONE, cap = 0;
 
-    pack *px = NULL;
-
-    while (fgets(s, MAX_U8, fp) != NULL) {
+    while ((line = lineGet(fp, s, MAX_U8, &big, &cap)) != NULL) {
         int len = 0;
-        char *data = strstr(s, (char *)"P");
+        char *data = strstr(line, (char *)"P");
         if (data){
             len = strlen(data);
         }
@@ -207,35 +682,41 @@ pack *text2Pac(FILE *fp)
             case 'i': // pack->info
                 break;
             case 'd': // pack->dn
+                memFree(MEM_PARSER, dn);
                 dn = indexes_of(data, ": ", ",");
                 break;
             case 'l': // pack->xl
+                memFree(MEM_PARSER, p_xl);
                 p_xl = indexes_of(data, ": ", ",");
-                xl = atof(p_xl);
+                xl = p_xl ? atof(p_xl) : 0;
                 break;
             case 'x': // pack->xt
+                memFree(MEM_PARSER, xt);
                 xt = indexes_of(data, ": ", ",");
                 break;
             case 't': // pack->tr
-                tr = indexes_of(data, ": ", ",");
+                p_tr = strstr(data, ": ");
+                if (p_tr)
+                    tr = trackerMapGet(map, p_tr + 2, ch);
                 break;
-            case '}': // end of pack
-                px = newPack(dn, xl, xt, tr);
-                if (dn)
-                    free(dn);
-                if (p_xl)
-                    free(p_xl);
-                if (xt)
-                    free(xt);
-                if (tr)
-                    free(tr);
-                return px;
+            case '}': { // end of pack
+                bool ok = dn && xt && bb.add(dn, xl, xt, tr) != NULL;
+                memFree(MEM_PARSER, dn);
+                memFree(MEM_PARSER, p_xl);
+                memFree(MEM_PARSER, xt);
+                memFree(MEM_PARSER, big);
+                return ok;
+            }
             default :
                 break;
             }
         }
     }
-    return px;
+    memFree(MEM_PARSER, dn);
+    memFree(MEM_PARSER, p_xl);
+    memFree(MEM_PARSER, xt);
+    memFree(MEM_PARSER, big);
+    return 0;
 }
 
 tran *text2Tran(FILE *fp)
@@ -243,32 +724,26 @@ tran *text2Tran(FILE *fp)
     return NULL;
 }
 
-block *text2Block(FILE *fp)
+block *text2Block(FILE *fp, chain *ch, trackerMap *map)
 {
     char s[MAX_U8 + 1];
-    pack **packs = NULL;
     char * tmp;
+    // the header lines come first, they are set once the block is over
+    BlockBuilder bb(0, 0, 0);
     uint32_t time = 0;
     uint32_t crc = 0;
-    uint16_t n_pack = 0;
-    uint16_t n_tran = 0;
     uint32_t n = 0;
     uint64_t key = 0;
-    block *new_block = NULL;
-
 
+    if (!bb.ok()) {
+        log_msg_default;
+        return NULL;
+    }
     while (fgets(s, MAX_U8, fp) != NULL) {
         if (strstr(s, (char *)"{P") != NULL) {
-            pack *px = text2Pac(fp);
-            if (px != NULL) {
-                n_pack++;
-                if (n_pack > MAX_U16) {
-                    deletePack(px);
-                    log_msg_custom("nPack limit reached\n");
-                    break;
-                }
-                packs = (pack**)realloc(packs, sizeof(pack *) * n_pack);
-                packs[n_pack - 1] = px;
+            if (!text2Pac(fp, ch, map, bb)) {
+                log_msg_custom("Adding a text pack failed");
+                return NULL;
             }
         } else {
             int len = 0;
@@ -279,56 +754,51 @@ block *text2Block(FILE *fp)
                 switch (data[1]) {
                 case 'g': // block->time
                     tmp = indexes_of(data, ": ", ",");
-                    time = atol(tmp);
-                    if (tmp) free(tmp);
+                    time = tmp ? atol(tmp) : 0;
+                    memFree(MEM_PARSER, tmp);
                     break;
                 case 'c': // block->crc
                     tmp = indexes_of(data, ": ", ",");
-                    crc = atol(tmp);
-                    if (tmp) free(tmp);
+                    crc = tmp ? atol(tmp) : 0;
+                    memFree(MEM_PARSER, tmp);
                     break;
                 case 'p': // block->nPack
-                    /* n_pack is being counted in the other
-                     * part of the loop
+                    /* packs are counted by the builder
                      */
-                    //tmp = indexes_of(data, ": ", ",");
-                    //n_pack = atol(tmp);
-                    //if (tmp) free(tmp);
                     break;
                 case 't': // block->nTran
-                    tmp = indexes_of(data, ": ", ",");
-                    n_tran = atol(tmp);
-                    if (tmp) free(tmp);
+                    /* trans are not read back
+                     */
                     break;
                 case 'n': // block->n
                     tmp = indexes_of(data, ": ", ",");
-                    n = atol(tmp);
-                    if (tmp) free(tmp);
+                    n = tmp ? atol(tmp) : 0;
+                    memFree(MEM_PARSER, tmp);
                     break;
                 case 'k': // block->key
                     tmp = indexes_of(data, ": ", ",");
-                    key = strtoll(tmp, NULL, 10);
-                    if (tmp) free(tmp);
+                    key = tmp ? strtoll(tmp, NULL, 10) : 0;
+                    memFree(MEM_PARSER, tmp);
                     break;
                 case '}':
-                    new_block = restore_block(time, crc, n_pack,
-                                                  n_tran, n, key,
-                                                  packs);
-                    return new_block;
-                    break;
+                    bb.setN(n);
+                    bb.setKey(key);
+                    bb.setTime(time);
+                    bb.setCrc(crc);
+                    return bb.finish();
                 default :
                     break;
                 }
             }
         }
     }
-    //return (block *)newBlock(0, key, n_pack, packs);
-    return new_block;
+    return NULL; // truncated, the builder frees the block
 }
 
 int text2Chainz(FILE *fp, chain *ch)
 {
     char s[MAX_U8 + 1];
+    trackerMap map = {NULL, 0};
     if (ch == NULL)
         return 0;
     
@@ -337,7 +807,7 @@ int text2Chainz(FILE *fp, chain *ch)
      */
     while (fgets(s, MAX_U8, fp) != NULL) {
         if (strstr(s, (char *)"{B") != NULL) {
-            if (!insertBlock(text2Block(fp), ch))
+            if (!insertBlock(text2Block(fp, ch, &map), ch))
                 log_msg_custom("Failed to insert block");
         } else {
             int len = 0;
@@ -352,12 +822,17 @@ int text2Chainz(FILE *fp, chain *ch)
                         // Csize
                     case 's':
                         break;
+                    case 'd':
+                        // Cdict, tracker dictionary
+                        trackerMapAdd(&map, data, ch);
+                        break;
                     default :
                         break;
                 }
             }
         }
     }
+    memFree(MEM_PARSER, map.id);
     return 1;
 }
 
@@ -369,62 +844,402 @@ chain *file_2_chainz(FILE *fp)
     return NULL;
 }
 
+#define PART_BLOCK_TEXT 100 // bytes of a {B without its packs and trans
+#define PART_PACK_TEXT   80 // bytes of a {P without its dn and xt
+#define PART_TRAN_TEXT  110 // bytes of a {T
+
+/* Bytes blockToBuf writes for a block, give or take a few digits per
+ * line. Names and topics are most of a part in every format, so the
+ * same estimate balances binary and framed parts too. */
+static uint64_t blockTextSize(block *bx)
+{
+    uint64_t n = PART_BLOCK_TEXT + (uint64_t)bx->nTran * PART_TRAN_TEXT
+        + (uint64_t)bx->nPack * PART_PACK_TEXT;
+    pack **pk = blockPacks(bx);
+    if (pk == NULL) {
+        // columnar only, the names and XT_STR topics are in the heap
+        if (bx->cols)
+            n += bx->cols->heapLen
+                + (uint64_t)bx->nPack * (XT_BTIH_PREFIX_LEN + 40);
+        return n;
+    }
+    for (uint16_t i = 0; i < bx->nPack; i++) {
+        n += pk[i]->dn ? strlen(pk[i]->dn) : 6;
+        if (pk[i]->xtType == XT_BTIH_HEX)
+            n += XT_BTIH_PREFIX_LEN + 40;
+        else if (pk[i]->xtType == XT_BTIH_B32)
+            n += XT_BTIH_PREFIX_LEN + 32;
+        else if (pk[i]->xt.str)
+            n += strlen(pk[i]->xt.str);
+    }
+    return n;
+}
+
+/* Arguments of a blockTextSize task */
+typedef struct
+{
+    chain    *ch;
+    uint32_t  start;
+    uint32_t  end;
+    uint64_t *est; // est[i] for block i, shared by the tasks
+}sizeWork;
+
+static void *sizeWorker(void *args)
+{
+    sizeWork *sw = (sizeWork *)args;
+    for (uint32_t i = sw->start; i < sw->end; i++)
+        sw->est[i] = blockTextSize(chainBlock(sw->ch, i));
+    return NULL;
+}
+
+/* Cut [0, size) in parts runs of about the same serialized size, the
+ * cuts only depend on the blocks so the part files are the same from
+ * run to run. stat[k] gets the run of part k + 1 and its estimate. */
+static void partCut(chain *ch, uint32_t size, uint8_t parts, partStat *stat)
+{
+    uint64_t *est = size ? (uint64_t *)memAlloc(MEM_IO, sizeof(uint64_t)
+                                                * size) : NULL;
+    uint64_t total = 0;
+    uint32_t i, at = 0;
+    if (est) {
+        // blocks loaded header only are decoded here, spread it out
+        sizeWork sw[parts];
+        poolGroup g;
+        poolGroupInit(&g);
+        for (i = 0; i < parts; i++) {
+            sw[i].ch = ch;
+            sw[i].start = (uint64_t)size * i / parts;
+            sw[i].end = (uint64_t)size * (i + 1) / parts;
+            sw[i].est = est;
+            poolSubmit(&g, sizeWorker, &sw[i]);
+        }
+        poolWait(&g);
+        for (i = 0; i < size; i++)
+            total += est[i];
+    } else if (size) {
+        log_msg_custom("No memory to size the parts, cutting by count");
+    }
+
+    uint64_t sum = 0;
+    for (uint8_t k = 0; k < parts; k++) {
+        memset(&stat[k], 0, sizeof(partStat));
+        stat[k].start = at;
+        if (est) {
+            // a block goes to the part its first byte falls in
+            uint64_t cut = total * (k + 1) / parts;
+            while (at < size && (k == parts - 1 || sum < cut)) {
+                sum += est[at];
+                stat[k].est += est[at++];
+            }
+        } else {
+            at = (uint64_t)size * (k + 1) / parts;
+        }
+        stat[k].end = at;
+    }
+    memFree(MEM_IO, est);
+}
+
 //  return 1 for success, 0 for failure
-bool chainCompactor(chain *ch, uint8_t parts)
+bool chainCompactor(chain *ch, uint8_t parts, uint8_t fmt, partStat *stat,
+                    uint8_t depth)
 {
-    uint32_t size = ch->size,
-        target, // # of blocks each thread will compresss
-        done; // # of blocks assigned to threads
+    uint32_t size = chainSize(ch), ms = msNow(), slow = 0, sum = 0;
     uint8_t i;
+    bool ok = 1, show = stat == NULL; // a caller with stats prints its own
     
     if (parts == 0 || parts > MAX_U8) {
         parts = 1;
     }
-    pthread_t threads[parts];
     threadParams tp[parts];
+    partStat mine[parts];
+    poolGroup g;
     
-    done = 0;
-    target = size / parts;
-    
+    if (show)
+        stat = mine;
+    partCut(ch, size, parts, stat);
+    poolGroupInit(&g);
     for (i = 0; i < parts; i++) {
         tp[i].i = i + 1;
-        tp[i].head = ch->head;
-        tp[i].start = done;
-        done += target;
-        if (i == 0)
-            done += (size % parts);
-        tp[i].end = done;
+        tp[i].ch = ch;
+        tp[i].fmt = fmt;
+        tp[i].start = stat[i].start;
+        tp[i].end = stat[i].end;
+        tp[i].stat = &stat[i];
+        tp[i].depth = depth;
         
-        if(pthread_create(&threads[i], NULL, blockToText, (void *)&tp[i]))
-        {
-            //temporary fix
-            printf("\nFailing to create threads, falling back to single thread\n");
-            chainToText(ch, 1);
-            return 1;
-        }
+        poolSubmit(&g, blockToText, (void *)&tp[i]);
     }
+    poolWait(&g);
     for (i = 0; i < parts; i++)
-        pthread_join(threads[i], NULL);
+        ok = ok && tp[i].ok;
+    if (!ok)
+        log_msg_custom("A chain part is missing or truncated");
+    if (!show)
+        return ok;
 
-    return 1;
+    // the slowest part sets the wall time, show how far off the rest are
+    for (i = 0; i < parts; i++) {
+        printf("  part %u: %u blocks, %llu bytes written, %llu est, %u ms\n",
+               i + 1, stat[i].end - stat[i].start,
+               (unsigned long long)stat[i].bytes,
+               (unsigned long long)stat[i].est, stat[i].ms);
+        // bytes per us are MB/s
+        if (stat[i].raw)
+            printf("    serialize %.1f MB/s, encode %.1f MB/s, "
+                   "encoder waited %llu ms, queue full %u times\n",
+                   stat[i].serUs ? (double)stat[i].raw / stat[i].serUs : 0,
+                   stat[i].encUs ? (double)stat[i].raw / stat[i].encUs : 0,
+                   (unsigned long long)stat[i].waitUs / 1000, stat[i].full);
+        sum += stat[i].ms;
+        if (stat[i].ms > slow)
+            slow = stat[i].ms;
+    }
+    printf("  slowest part %u ms, mean %u ms, %u ms in all\n", slow,
+           sum / parts, msNow() - ms);
+
+    return ok;
 }
 
-//  return 1 for success, 0 for failure
-/* Right now dont worry about compressing/decompressing
+/** @brief Decoded buffers in flight between the two threads of
+ * lzmaFile2Chain */
+#define LOAD_BUFS 4
+
+/* ISeqOutStream the decoder writes to, each write is copied to a free
+ * buffer and queued for the parser */
+typedef struct
+{
+    ISeqOutStream out;   // must be first, the decoder passes &out back
+    FILE    *fp;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    uint8_t *buf[LOAD_BUFS];
+    uint32_t len[LOAD_BUFS];
+    uint32_t head;       // buffers queued so far, the next is buf[head % LOAD_BUFS]
+    uint32_t tail;       // buffers parsed so far
+    bool     done;       // the decoder returned
+    bool     stop;       // the parser failed, later writes are refused
+    bool     ok;         // what the decoder returned
+}loadQueue;
+
+static size_t loadWrite(void *p, const void *data, size_t len)
+{
+    loadQueue *q = (loadQueue *)p;
+    pthread_mutex_lock(&q->lock);
+    while (q->head - q->tail == LOAD_BUFS && !q->stop)
+        pthread_cond_wait(&q->cond, &q->lock);
+    if (q->stop) {
+        pthread_mutex_unlock(&q->lock);
+        return 0;
+    }
+    uint32_t i = q->head % LOAD_BUFS;
+    pthread_mutex_unlock(&q->lock);
+
+    // the slot is the decoder's until head moves past it
+    memcpy(q->buf[i], data, len);
+    q->len[i] = len;
+
+    pthread_mutex_lock(&q->lock);
+    q->head++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return len;
+}
+
+static void *loadDecode(void *args)
+{
+    loadQueue *q = (loadQueue *)args;
+    bool ok = decompress_to_stream(q->fp, &q->out);
+    pthread_mutex_lock(&q->lock);
+    q->ok = ok;
+    q->done = 1;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+bool lzmaFile2Chain(FILE *fp, chain *ch, uint8_t fmt)
+{
+    loadQueue q;
+    textStream ts;
+    binStream bs;
+    pthread_t tid;
+    bool ok = 1, bin = fmt == CHAIN_BIN;
+
+    if (fmt == CHAIN_FRAME) {
+        log_msg_custom("Framed parts are not compressed as a whole");
+        return 0;
+    }
+    memset(&q, 0, sizeof(q));
+    q.out.Write = loadWrite;
+    q.fp = fp;
+    ok = bin ? binStreamInit(&bs) : textStreamInit(&ts);
+    for (uint32_t i = 0; i < LOAD_BUFS; i++) {
+        q.buf[i] = (uint8_t *)memAlloc(MEM_IO, buffer_cread_size);
+        ok = ok && q.buf[i];
+    }
+    pthread_mutex_init(&q.lock, NULL);
+    pthread_cond_init(&q.cond, NULL);
+
+    // decode on a thread of its own, parse on this one as buffers come
+    bool started = ok && pthread_create(&tid, NULL, loadDecode, &q) == 0;
+    if (!started) {
+        log_msg_custom("Starting the part decoder failed");
+        q.stop = 1;
+        q.done = 1;
+    }
+    pthread_mutex_lock(&q.lock);
+    for (;;) {
+        while (q.head == q.tail && !q.done)
+            pthread_cond_wait(&q.cond, &q.lock);
+        if (q.head == q.tail || q.stop)
+            break;
+        uint32_t i = q.tail % LOAD_BUFS;
+        pthread_mutex_unlock(&q.lock);
+        ok = bin ? binStreamFeed(&bs, q.buf[i], q.len[i], ch)
+            : textStreamFeed(&ts, q.buf[i], q.len[i], ch);
+        pthread_mutex_lock(&q.lock);
+        q.tail++;
+        q.stop = !ok;
+        pthread_cond_broadcast(&q.cond);
+    }
+    pthread_mutex_unlock(&q.lock);
+    if (started)
+        pthread_join(tid, NULL);
+
+    ok = ok && started && q.ok;
+    ok = (bin ? binStreamEnd(&bs) : textStreamEnd(&ts, ch)) && ok;
+    pthread_cond_destroy(&q.cond);
+    pthread_mutex_destroy(&q.lock);
+    for (uint32_t i = 0; i < LOAD_BUFS; i++)
+        memFree(MEM_IO, q.buf[i]);
+    return ok;
+}
+
+/* One part of chain_extractor, loaded into a chain of its own */
+typedef struct
+{
+    char     path[PART_PATH_MAX];
+    uint8_t  fmt;
+    chain   *ch;
+    uint32_t first; // n of its first block
+    bool     ok;
+}extractPart;
+
+/* Load a part, a .7z one is parsed as it is decompressed */
+static void *extractWorker(void *args)
+{
+    extractPart *ep = (extractPart *)args;
+    size_t plen = strlen(ep->path);
+    bool lzma = plen > 3 && strcmp(ep->path + plen - 3, ".7z") == 0;
+
+    ep->ok = 0;
+    if (ep->fmt == CHAIN_FRAME && !lzma) {
+        frameFile *ff = frameOpen(ep->path, ep->ch);
+        ep->ok = ff && frameLoad(ff, ep->ch, 1);
+        frameClose(ff);
+        return NULL;
+    }
+    FILE *fp = fopen(ep->path, "rb");
+    if (fp == NULL) {
+        char msg[PART_PATH_MAX + 32];
+        snprintf(msg, sizeof(msg), "Opening part [%s] failed", ep->path);
+        log_msg_custom(msg);
+        return NULL;
+    }
+    if (!lzma) {
+        ep->ok = ep->fmt == CHAIN_BIN ? binFile2Chain(fp, ep->ch)
+            : textFile2Chain(fp, ep->ch);
+    } else {
+        ep->ok = lzmaFile2Chain(fp, ep->ch, ep->fmt);
+    }
+    fclose(fp);
+    return NULL;
+}
+
+static int extractCmp(const void *a, const void *b)
+{
+    const extractPart *x = *(const extractPart **)a,
+        *y = *(const extractPart **)b;
+    return (x->first > y->first) - (x->first < y->first);
+}
+
+/* Order the loaded parts by their first block, every block must follow
+ * the one before it, across parts too
+ *
+ * @return 0 - a gap or an overlap, it is logged
  */
-chain *chain_extractor(const char *inFile, uint8_t parts)
+static bool extractOrder(extractPart **order, uint8_t parts)
 {
-    char buffy[69];
-    chain *ch = newChain();
-    FILE *fp = NULL;
-    for (int i = 1; i <= parts; i++){
-        sprintf(buffy,"temp%d.file",i);
-        fp = fopen(buffy, "r");
-        if (fp == NULL){
-            log_msg_default;
-            continue;
+    char msg[PART_PATH_MAX + 64];
+    for (uint8_t i = 0; i < parts; i++) {
+        order[i]->first = chainSize(order[i]->ch)
+            ? chainBlock(order[i]->ch, 0)->n : MAX_U32;
+    }
+    qsort(order, parts, sizeof(extractPart *), extractCmp);
+
+    uint32_t next = order[0]->first;
+    for (uint8_t i = 0; i < parts; i++) {
+        chain *ch = order[i]->ch;
+        for (uint32_t j = 0; j < chainSize(ch); j++, next++) {
+            uint32_t n = chainBlock(ch, j)->n;
+            if (n != next) {
+                snprintf(msg, sizeof(msg), "Part [%s] has block %u where "
+                         "%u should be, %s", order[i]->path, n, next,
+                         n > next ? "a gap" : "an overlap");
+                log_msg_custom(msg);
+                return 0;
+            }
         }
-        text2Chainz(fp, ch);
+    }
+    return 1;
+}
+
+chain *chain_extractor(const char *inFile, uint8_t parts, uint8_t fmt)
+{
+    if (parts == 0)
+        parts = 1;
+    extractPart ep[parts];
+    extractPart *order[parts];
+    poolGroup g;
+    bool ok = 1;
+
+    memset(ep, 0, sizeof(ep));
+    for (uint8_t i = 0; i < parts; i++) {
+        ep[i].fmt = fmt;
+        ep[i].ch = newChain();
+        order[i] = &ep[i];
+        ok = ok && ep[i].ch
+            && partPath(ep[i].path, sizeof(ep[i].path), inFile, i + 1, fmt);
+    }
+    // one loader per part, the mirror of chainCompactor
+    poolGroupInit(&g);
+    for (uint8_t i = 0; ok && i < parts; i++)
+        poolSubmit(&g, extractWorker, (void *)&ep[i]);
+    poolWait(&g);
+    for (uint8_t i = 0; i < parts; i++)
+        ok = ok && ep[i].ok;
+    ok = ok && extractOrder(order, parts);
+
+    chain *ch = ok ? newChain() : NULL;
+    ok = ch != NULL;
+    for (uint8_t i = 0; ok && i < parts; i++)
+        ok = chainAppend(ch, order[i]->ch);
+    for (uint8_t i = 0; i < parts; i++) {
+        if (ep[i].ch) {
+            deleteChain(ep[i].ch);
+            memFree(MEM_CHAIN, ep[i].ch);
+        }
+    }
+    if (ok && chainVerify(ch, 0, chainSize(ch), VERIFY_THREADS))
+        ok = 0;
+
+    if (!ok) {
+        log_msg_custom("Extracting the chain failed");
+        if (ch) {
+            deleteChain(ch);
+            memFree(MEM_CHAIN, ch);
+        }
+        return NULL;
     }
     return ch;
 }
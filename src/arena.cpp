@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "log.h"
+
+/* Round up to the arena alignment */
+static inline uint32_t arenaPad(uint32_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(uint32_t)(ARENA_ALIGN - 1);
+}
+
+/* Usable memory of a chunk starts right after its header */
+static inline char *chunkData(arenaChunk *ck)
+{
+    return (char *)ck + arenaPad(sizeof(arenaChunk));
+}
+
+/* Push a fresh chunk with at least size usable bytes */
+static arenaChunk *arenaGrow(arena *ar, uint32_t size)
+{
+    /* grow by a fraction of what is held so a low estimate only costs
+     * one more small chunk, while unsized arenas still grow geometrically */
+    uint32_t cap = ar->bytes / 2;
+    if (cap < ARENA_CHUNK)
+        cap = ARENA_CHUNK;
+    if (cap < size)
+        cap = arenaPad(size);
+
+    uint32_t total = arenaPad(sizeof(arenaChunk)) + cap;
+    arenaChunk *ck = (arenaChunk *)memAlloc(ar->sub, total);
+    if (ck == NULL) {
+        log_msg_default;
+        return NULL;
+    }
+    ck->next = ar->head;
+    ck->cap = cap;
+    ck->used = 0;
+    ar->head = ck;
+    ar->bytes += total;
+    return ck;
+}
+
+void arenaInit(arena *ar, uint8_t sub)
+{
+    ar->head = NULL;
+    ar->bytes = 0;
+    ar->sub = sub;
+}
+
+bool arenaReserve(arena *ar, uint32_t size)
+{
+    if (ar->head != NULL && ar->head->cap - ar->head->used >= size)
+        return 1;
+    return arenaGrow(ar, size) != NULL;
+}
+
+void *arenaAlloc(arena *ar, uint32_t size)
+{
+    arenaChunk *ck = ar->head;
+    uint32_t off = ck ? arenaPad(ck->used) : 0; // strings leave it unaligned
+    if (ck == NULL || off > ck->cap || ck->cap - off < size) {
+        ck = arenaGrow(ar, size);
+        if (ck == NULL)
+            return NULL;
+        off = 0;
+    }
+    void *ptr = chunkData(ck) + off;
+    ck->used = off + size;
+    return ptr;
+}
+
+char *arenaStrndup(arena *ar, const char *str, uint32_t len)
+{
+    /* strings don't need the alignment, pack them tightly */
+    arenaChunk *ck = ar->head;
+    if (ck == NULL || ck->cap - ck->used < len + 1) {
+        ck = arenaGrow(ar, len + 1);
+        if (ck == NULL)
+            return NULL;
+    }
+    char *dst = chunkData(ck) + ck->used;
+    memcpy(dst, str, len);
+    dst[len] = '\0';
+    ck->used += len + 1;
+    return dst;
+}
+
+uint32_t arenaRelease(arena *ar)
+{
+    /* the arena may live inside one of its own chunks, copy it out */
+    arenaChunk *ck = ar->head;
+    uint32_t bytes = ar->bytes;
+    ar->head = NULL;
+    ar->bytes = 0;
+    while (ck != NULL) {
+        arenaChunk *next = ck->next;
+        memFree(ar->sub, ck);
+        ck = next;
+    }
+    return bytes;
+}
@@ -0,0 +1,155 @@
+#include <string.h>
+#include <time.h>
+
+#include "blockbuilder.h"
+#include "arena.h"
+#include "infohash.h"
+#include "log.h"
+
+BlockBuilder::BlockBuilder(uint32_t n, uint64_t key, uint16_t nPack,
+                           uint32_t strBytes)
+    : bx(NULL), cap(0)
+{
+    arena ar;
+    arenaInit(&ar);
+    /* one chunk for the header, the pack array and the packs, the
+     * strings only spill into a second one if strBytes was too low */
+    uint32_t need = sizeof(block) + ARENA_ALIGN
+        + nPack * (sizeof(pack *) + sizeof(pack) + ARENA_ALIGN)
+        + strBytes;
+    if (!arenaReserve(&ar, need))
+        return;
+
+    block *b = (block *)arenaAlloc(&ar, sizeof(block));
+    b->packs = (pack **)arenaAlloc(&ar, sizeof(pack *) * nPack);
+    b->time = (uint32_t)time(NULL);
+    b->crc = 0;
+    b->nPack = 0;
+    b->nTran = 0;
+    b->n = n;
+    b->key = key;
+    b->trans = NULL;
+    b->cols = NULL;
+    b->src = NULL;
+    b->lazy = NULL;
+    b->mem = ar; // from here on only use the copy inside the block
+    bx = b;
+    cap = nPack;
+}
+
+BlockBuilder::~BlockBuilder()
+{
+    release();
+}
+
+BlockBuilder::BlockBuilder(BlockBuilder &&o) noexcept
+    : bx(o.bx), cap(o.cap)
+{
+    o.bx = NULL;
+    o.cap = 0;
+}
+
+BlockBuilder &BlockBuilder::operator=(BlockBuilder &&o) noexcept
+{
+    if (this != &o) {
+        release();
+        bx = o.bx;
+        cap = o.cap;
+        o.bx = NULL;
+        o.cap = 0;
+    }
+    return *this;
+}
+
+void BlockBuilder::release()
+{
+    if (bx != NULL)
+        arenaRelease(&bx->mem); // bx itself is in there
+    bx = NULL;
+    cap = 0;
+}
+
+block *BlockBuilder::finish()
+{
+    block *b = bx;
+    bx = NULL;
+    cap = 0;
+    return b;
+}
+
+/* Make room for one more pack and set up everything but the topic */
+pack *BlockBuilder::newPackSlot(std::string_view dn)
+{
+    if (bx == NULL || dn.size() > PACK_STR_MAX || bx->nPack == MAX_U16)
+        return NULL;
+
+    if (bx->nPack == cap) {
+        // arena memory can't be given back, the old array is just dropped
+        uint32_t ncap = cap ? (uint32_t)cap * 2 : 8;
+        if (ncap > MAX_U16)
+            ncap = MAX_U16;
+        pack **tmp = (pack **)arenaAlloc(&bx->mem, sizeof(pack *) * ncap);
+        if (tmp == NULL)
+            return NULL;
+        memcpy(tmp, bx->packs, sizeof(pack *) * bx->nPack);
+        bx->packs = tmp;
+        cap = ncap;
+    }
+
+    pack *px = (pack *)arenaAlloc(&bx->mem, sizeof(pack));
+    if (px == NULL)
+        return NULL;
+    px->dn = arenaStrndup(&bx->mem, dn.data(), dn.size());
+    if (px->dn == NULL)
+        return NULL;
+    memset(px->info, 0, sizeof(px->info));
+    memcpy(px->info, dn.data(), dn.size() < 5 ? dn.size() : 5);
+    return px;
+}
+
+pack *BlockBuilder::add(std::string_view dn, uint64_t xl,
+                        std::string_view xt, uint32_t tr)
+{
+    if (xt.size() > PACK_STR_MAX)
+        return NULL;
+    pack *px = newPackSlot(dn);
+    if (px == NULL)
+        return NULL;
+
+    px->xl = xl;
+    px->tr = tr;
+    // btih topics are kept as the raw digest, no string copy
+    px->xtType = xtParse(xt.data(), xt.size(), &px->xt.hash);
+    if (px->xtType == XT_STR) {
+        px->xt.str = arenaStrndup(&bx->mem, xt.data(), xt.size());
+        if (px->xt.str == NULL)
+            return NULL;
+    }
+
+    bx->packs[bx->nPack++] = px;
+    return px;
+}
+
+pack *BlockBuilder::add(std::string_view dn, uint64_t xl, uint8_t xtType,
+                        const infohash &hash, uint32_t tr)
+{
+    if (xtType == XT_STR)
+        return NULL;
+    pack *px = newPackSlot(dn);
+    if (px == NULL)
+        return NULL;
+    px->xl = xl;
+    px->tr = tr;
+    px->xtType = xtType;
+    px->xt.hash = hash;
+
+    bx->packs[bx->nPack++] = px;
+    return px;
+}
+
+pack *BlockBuilder::add(const PackView &pv)
+{
+    if (pv.xtType() == XT_STR)
+        return add(pv.dn(), pv.xl(), pv.xtStr(), pv.tr());
+    return add(pv.dn(), pv.xl(), pv.xtType(), *pv.hash(), pv.tr());
+}
@@ -0,0 +1,513 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chainbin.h"
+#include "alib.h"
+#include "outbuf.h"
+#include "strtab.h"
+#include "blockbuilder.h"
+#include "memstat.h"
+#include "log.h"
+
+/** @brief Packs whose string lengths blockToBin keeps on the stack */
+#define BIN_LEN_STACK 256
+
+/* Bytes blockToBin writes after the header, len gets the dn and topic
+ * length of every pack so the names are measured only once */
+static uint32_t binBodySize(block *bx, pack **all, uint16_t *len)
+{
+    uint32_t i, size = (uint32_t)bx->nTran * CHAIN_BIN_TRAN;
+
+    for (i = 0; i < bx->nPack; i++) {
+        pack *pk = all ? all[i] : blockPack(bx, i);
+        // BlockBuilder keeps both strings in PACK_STR_MAX
+        len[2 * i] = pk && pk->dn ? strlen(pk->dn) : 0;
+        len[2 * i + 1] = pk && pk->xtType == XT_STR && pk->xt.str
+            ? strlen(pk->xt.str) : 0;
+        // dnLen, xl, tr, xtType
+        size += 2 + 8 + 4 + 1 + len[2 * i];
+        if (pk && pk->xtType != XT_STR)
+            size += sizeof(pk->xt.hash.b);
+        else
+            size += 2 + len[2 * i + 1];
+    }
+    return size;
+}
+
+/* One pack, stored in place when the whole record fits */
+static void binPackPut(outBuf *ob, pack *pk, uint16_t dnLen, uint16_t xtLen)
+{
+    char *p = pk ? outBufRoom(ob, 2 + 8 + 4 + 1 + 2 + dnLen
+                              + (xtLen > sizeof(infohash)
+                                 ? xtLen : sizeof(infohash))) : NULL;
+    if (p != NULL) {
+        p = outBufStore16(p, dnLen);
+        memcpy(p, pk->dn, dnLen);
+        p = outBufStore64(p + dnLen, pk->xl);
+        p = outBufStore32(p, pk->tr);
+        if (pk->xtType != XT_STR) {
+            *p++ = pk->xtType;
+            memcpy(p, pk->xt.hash.b, sizeof(pk->xt.hash.b));
+            p += sizeof(pk->xt.hash.b);
+        } else {
+            *p++ = XT_STR;
+            p = outBufStore16(p, xtLen);
+            memcpy(p, pk->xt.str, xtLen);
+            p += xtLen;
+        }
+        ob->len = p - ob->buf;
+        return;
+    }
+
+    outBufPut16(ob, dnLen);
+    outBufWrite(ob, pk ? pk->dn : "", dnLen);
+    outBufPut64(ob, pk ? pk->xl : 0);
+    outBufPut32(ob, pk ? pk->tr : STRTAB_NONE);
+    if (pk && pk->xtType != XT_STR) {
+        outBufPut8(ob, pk->xtType);
+        outBufWrite(ob, pk->xt.hash.b, sizeof(pk->xt.hash.b));
+    } else {
+        outBufPut8(ob, XT_STR);
+        outBufPut16(ob, xtLen);
+        outBufWrite(ob, xtLen ? pk->xt.str : "", xtLen);
+    }
+}
+
+void blockToBin(block *bx, binBlock *h, outBuf *ob)
+{
+    uint32_t i;
+    uint16_t stackLen[2 * BIN_LEN_STACK];
+    uint16_t *len = stackLen;
+    pack **all = blockPacks(bx);
+
+    if (bx->nPack > BIN_LEN_STACK) {
+        len = (uint16_t *)memAlloc(MEM_IO, sizeof(uint16_t) * 2 * bx->nPack);
+        if (len == NULL) {
+            log_msg_default;
+            ob->err = 1;
+            return;
+        }
+    }
+
+    outBufVar(ob, binZigzag((int32_t)(bx->n - h->n - 1)));
+    outBufVar(ob, binZigzag((int32_t)(bx->time - h->time)));
+    outBufVar(ob, bx->nPack);
+    outBufVar(ob, bx->nTran);
+    outBufPut32(ob, bx->crc);
+    outBufVar(ob, bx->key);
+    h->body = binBodySize(bx, all, len);
+    outBufVar(ob, h->body);
+
+    h->n = bx->n;
+    h->time = bx->time;
+    h->nPack = bx->nPack;
+    h->nTran = bx->nTran;
+    h->crc = bx->crc;
+    h->key = bx->key;
+
+    for (i = 0; i < bx->nPack; i++)
+        binPackPut(ob, all ? all[i] : blockPack(bx, i), len[2 * i],
+                   len[2 * i + 1]);
+    for (i = 0; i < bx->nTran; i++) {
+        tran *tx = bx->trans[i];
+        outBufPut32(ob, tx->time);
+        outBufPut32(ob, tx->id);
+        outBufPut64(ob, tx->src);
+        outBufPut64(ob, tx->dest);
+        outBufPut64(ob, tx->amount);
+        outBufPut64(ob, tx->key);
+    }
+    if (len != stackLen)
+        memFree(MEM_IO, len);
+}
+
+void partHeadBin(chain *ch, uint32_t nBlock, uint32_t part, outBuf *ob)
+{
+    uint32_t i, nDict = __atomic_load_n(&ch->trackers.n, __ATOMIC_ACQUIRE);
+
+    outBufWrite(ob, CHAIN_BIN_MAGIC, 4);
+    outBufPut16(ob, CHAIN_BIN_VERSION);
+    outBufPut16(ob, 0);
+    outBufPut32(ob, part);
+    outBufPut32(ob, nBlock);
+    outBufPut32(ob, nDict);
+
+    for (i = 0; i < nDict; i++) {
+        const char *url = strtabGet(&ch->trackers, i);
+        uint32_t len = strlen(url);
+        if (len > MAX_U16) {
+            log_msg_custom("Tracker url too long, written empty");
+            len = 0;
+        }
+        outBufPut16(ob, len);
+        outBufWrite(ob, url, len);
+    }
+}
+
+bool partToBin(chain *ch, uint32_t start, uint32_t end, uint32_t part,
+               FILE *fp)
+{
+    outBuf ob;
+    binBlock h;
+    uint32_t i;
+
+    if (!outBufInit(&ob, fp, OUTBUF_LARGE))
+        return 0;
+
+    partHeadBin(ch, end - start, part, &ob);
+    binBlockStart(&h);
+    for (i = start; i < end; ) {
+        uint32_t run, j;
+        block **bx = chainSpan(ch, i, end, &run);
+        for (j = 0; j < run; j++)
+            blockToBin(bx[j], &h, &ob);
+        i += run;
+    }
+
+    return outBufFree(&ob);
+}
+
+bool binPartHeader(binCursor *c, binPart *h)
+{
+    if (!binHave(c, CHAIN_BIN_HEADER) || memcmp(c->p, CHAIN_BIN_MAGIC, 4)) {
+        log_msg_custom("Not a binary chain part");
+        return 0;
+    }
+    c->p += 4;
+    if (binGet16(c) != CHAIN_BIN_VERSION) {
+        log_msg_custom("Unsupported binary chain version");
+        return 0;
+    }
+    binGet16(c); // flags
+    h->part = binGet32(c);
+    h->nBlock = binGet32(c);
+    h->nDict = binGet32(c);
+    return 1;
+}
+
+bool binDictEntry(binCursor *c, std::string_view *url)
+{
+    if (!binHave(c, 2))
+        return 0;
+    uint16_t len = c->p[0] | c->p[1] << 8;
+    if (!binHave(c, 2 + len))
+        return 0;
+    *url = std::string_view((const char *)c->p + 2, len);
+    c->p += 2 + len;
+    return 1;
+}
+
+/* Walk the packs and trans of a block without building anything
+ *
+ * Checks every length against the end of the data and sums the bytes
+ * BlockBuilder will need for the strings.
+ */
+static bool binSkipBlock(binCursor *c, uint16_t nPack, uint16_t nTran,
+                         uint32_t *strBytes)
+{
+    *strBytes = 0;
+    for (uint16_t i = 0; i < nPack; i++) {
+        if (!binHave(c, 2))
+            return 0;
+        uint16_t len = c->p[0] | c->p[1] << 8;
+        // dn, xl, tr, xtType
+        if (!binHave(c, 2 + len + 8 + 4 + 1))
+            return 0;
+        c->p += 2 + len + 8 + 4;
+        *strBytes += len + 1;
+        uint8_t xtType = *c->p++;
+        if (xtType == XT_STR) {
+            if (!binHave(c, 2))
+                return 0;
+            len = c->p[0] | c->p[1] << 8;
+            if (!binHave(c, 2 + len))
+                return 0;
+            *strBytes += len + 1;
+            c->p += 2 + len;
+        } else if (xtType == XT_BTIH_HEX || xtType == XT_BTIH_B32) {
+            if (!binHave(c, sizeof(infohash)))
+                return 0;
+            c->p += sizeof(infohash);
+        } else {
+            return 0;
+        }
+    }
+    if (!binHave(c, (size_t)nTran * CHAIN_BIN_TRAN))
+        return 0;
+    c->p += (size_t)nTran * CHAIN_BIN_TRAN;
+    return 1;
+}
+
+void binBlockGet(binCursor *c, binBlock *h)
+{
+    h->n += 1 + binUnzigzag((uint32_t)binGetVar(c));
+    h->time += binUnzigzag((uint32_t)binGetVar(c));
+    h->nPack = (uint16_t)binGetVar(c);
+    h->nTran = (uint16_t)binGetVar(c);
+    h->crc = binGet32(c);
+    h->key = binGetVar(c);
+    h->body = (uint32_t)binGetVar(c);
+}
+
+/* Checked binBlockGet, the body is not looked at */
+static bool binHeadCheck(binCursor *c, binBlock *h)
+{
+    uint64_t n, time, nPack, nTran, key, body;
+
+    // the common case, binBlockGet can't run past the end: 6 varints
+    // of at most 10 bytes and the crc
+    if (binHave(c, 6 * 10 + 4)) {
+        const uint8_t *p = c->p;
+        binBlock tmp = *h;
+        binBlockGet(c, &tmp);
+        if (c->p - p > CHAIN_BIN_BLOCK_MAX) {
+            c->p = p;
+            return 0;
+        }
+        *h = tmp;
+        return 1;
+    }
+    if (!binVar(c, &n) || !binVar(c, &time) || !binVar(c, &nPack)
+        || !binVar(c, &nTran) || !binHave(c, 4))
+        return 0;
+    uint32_t crc = binGet32(c);
+    if (!binVar(c, &key) || !binVar(c, &body))
+        return 0;
+    h->n += 1 + binUnzigzag((uint32_t)n);
+    h->time += binUnzigzag((uint32_t)time);
+    h->nPack = (uint16_t)nPack;
+    h->nTran = (uint16_t)nTran;
+    h->crc = crc;
+    h->key = key;
+    h->body = (uint32_t)body;
+    return 1;
+}
+
+bool binBlockSkip(binCursor *c, binBlock *h)
+{
+    if (!binHeadCheck(c, h) || !binHave(c, h->body))
+        return 0;
+    c->p += h->body;
+    return 1;
+}
+
+bool binBlockBody(const uint8_t *p, const binBlock *h, uint32_t *strBytes)
+{
+    // the walk must end right on the body size
+    binCursor body = {p, p + h->body};
+    return binSkipBlock(&body, h->nPack, h->nTran, strBytes)
+        && body.p == body.end;
+}
+
+bool binBlockHeader(binCursor *c, binBlock *h, binCursor *packs,
+                    uint32_t *strBytes)
+{
+    if (!binHeadCheck(c, h) || !binHave(c, h->body)
+        || !binBlockBody(c->p, h, strBytes))
+        return 0;
+    *packs = *c;
+    c->p += h->body;
+    return 1;
+}
+
+void binPackGet(binCursor *c, binPack *pk)
+{
+    uint16_t len = binGet16(c);
+    pk->dn = std::string_view((const char *)c->p, len);
+    c->p += len;
+    pk->xl = binGet64(c);
+    pk->tr = binGet32(c);
+    pk->xtType = *c->p++;
+    if (pk->xtType == XT_STR) {
+        len = binGet16(c);
+        pk->hash = NULL;
+        pk->xtStr = std::string_view((const char *)c->p, len);
+        c->p += len;
+    } else {
+        pk->hash = c->p;
+        pk->xtStr = std::string_view();
+        c->p += sizeof(infohash);
+    }
+}
+
+block *bin2Block(binCursor *c, binBlock *hp, const uint32_t *map,
+                 uint32_t nMap)
+{
+    binCursor packs;
+    uint32_t strBytes;
+    if (!binBlockHeader(c, hp, &packs, &strBytes)) {
+        log_msg_custom("Binary block truncated or corrupt");
+        return NULL;
+    }
+
+    const binBlock &h = *hp;
+    BlockBuilder bb(h.n, h.key, h.nPack, strBytes);
+    if (!bb.ok()) {
+        log_msg_default;
+        return NULL;
+    }
+    bb.setTime(h.time);
+    bb.setCrc(h.crc);
+
+    for (uint16_t i = 0; i < h.nPack; i++) {
+        binPack pk;
+        binPackGet(&packs, &pk);
+        uint32_t tr = pk.tr < nMap ? map[pk.tr] : STRTAB_NONE;
+        pack *px;
+        if (pk.xtType == XT_STR) {
+            px = bb.add(pk.dn, pk.xl, pk.xtStr, tr);
+        } else {
+            infohash hash;
+            memcpy(hash.b, pk.hash, sizeof(hash.b));
+            px = bb.add(pk.dn, pk.xl, pk.xtType, hash, tr);
+        }
+        if (px == NULL) {
+            log_msg_custom("Adding a binary pack failed");
+            return NULL;
+        }
+    }
+    return bb.finish();
+}
+
+bool binDictMap(binCursor *c, uint32_t nDict, chain *ch, uint32_t **map)
+{
+    *map = NULL;
+    if (nDict > 0) {
+        *map = (uint32_t *)memAlloc(MEM_PARSER, sizeof(uint32_t) * nDict);
+        if (*map == NULL) {
+            log_msg_default;
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < nDict; i++) {
+        std::string_view url;
+        if (!binDictEntry(c, &url)) {
+            log_msg_custom("Binary dict truncated");
+            memFree(MEM_PARSER, *map);
+            *map = NULL;
+            return 0;
+        }
+        (*map)[i] = strtabIntern(&ch->trackers, url.data(), url.size());
+    }
+    return 1;
+}
+
+bool bin2Chain(const uint8_t *data, size_t len, chain *ch)
+{
+    binCursor c = {data, data + len};
+    binPart h;
+    binBlock bh;
+    uint32_t i, *map;
+    bool ok = 1;
+
+    if (ch == NULL || !binPartHeader(&c, &h) || !binDictMap(&c, h.nDict, ch, &map))
+        return 0;
+
+    binBlockStart(&bh);
+    for (i = 0; i < h.nBlock && ok; i++)
+        ok = insertBlock(bin2Block(&c, &bh, map, h.nDict), ch);
+
+    memFree(MEM_PARSER, map);
+    return ok;
+}
+
+bool binStreamInit(binStream *bs)
+{
+    bs->map = NULL;
+    bs->dict = 0;
+    bs->done = 0;
+    binBlockStart(&bs->h);
+    bs->ok = outBufInit(&bs->in, NULL);
+    return bs->ok;
+}
+
+/* Read the header and dict once they are all in, 0 if not yet */
+static bool binStreamHead(binStream *bs, binCursor *c, chain *ch)
+{
+    if (!binHave(c, CHAIN_BIN_HEADER))
+        return 0;
+    binCursor t = *c;
+    if (!binPartHeader(&t, &bs->head)) {
+        bs->ok = 0;
+        return 0;
+    }
+    // walk the dict first, binDictMap would log a short one as corrupt
+    binCursor d = t;
+    std::string_view url;
+    for (uint32_t i = 0; i < bs->head.nDict; i++)
+        if (!binDictEntry(&d, &url))
+            return 0;
+    bs->ok = binDictMap(&t, bs->head.nDict, ch, &bs->map);
+    bs->dict = bs->ok;
+    *c = t;
+    return bs->dict;
+}
+
+bool binStreamFeed(binStream *bs, const void *data, uint32_t len, chain *ch)
+{
+    if (!bs->ok)
+        return 0;
+    outBufWrite(&bs->in, data, len);
+    if (bs->in.err) {
+        bs->ok = 0;
+        return 0;
+    }
+
+    binCursor c = {(const uint8_t *)bs->in.buf,
+                   (const uint8_t *)bs->in.buf + bs->in.len};
+    if (!bs->dict && !binStreamHead(bs, &c, ch))
+        return bs->ok;
+    while (bs->done < bs->head.nBlock) {
+        // only build blocks that are all in
+        binCursor t = c;
+        binBlock th = bs->h;
+        if (!binBlockSkip(&t, &th))
+            break;
+        block *bx = bin2Block(&c, &bs->h, bs->map, bs->head.nDict);
+        if (bx && !insertBlock(bx, ch)) {
+            deleteBlock(bx);
+            bx = NULL;
+        }
+        if (bx == NULL) {
+            bs->ok = 0;
+            return 0;
+        }
+        bs->done++;
+    }
+    uint32_t used = (const char *)c.p - bs->in.buf;
+    memmove(bs->in.buf, bs->in.buf + used, bs->in.len - used);
+    bs->in.len -= used;
+    return 1;
+}
+
+bool binStreamEnd(binStream *bs)
+{
+    bool ok = bs->ok && bs->dict && bs->done == bs->head.nBlock;
+    if (bs->ok && !ok)
+        log_msg_custom("Binary part truncated");
+    outBufFree(&bs->in);
+    memFree(MEM_PARSER, bs->map);
+    bs->map = NULL;
+    bs->ok = 0;
+    return ok;
+}
+
+bool binFile2Chain(FILE *fp, chain *ch)
+{
+    long len;
+    if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0
+        || fseek(fp, 0, SEEK_SET)) {
+        log_msg_default;
+        return 0;
+    }
+
+    uint8_t *data = (uint8_t *)memAlloc(MEM_IO, len ? len : 1);
+    if (data == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    bool ok = fread(data, 1, len, fp) == (size_t)len
+        && bin2Chain(data, len, ch);
+    memFree(MEM_IO, data);
+    return ok;
+}
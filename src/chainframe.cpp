@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "chainframe.h"
+#include "chainbin.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "alib.h"
+#include "memstat.h"
+#include "lzma_wrapper.h"
+#include "log.h"
+
+/* Frames written so far and where the next one goes */
+typedef struct
+{
+    frameEntry *e;
+    uint32_t    n;
+    uint32_t    cap;
+    uint64_t    off;   // file offset of the next frame
+    uint8_t    *dst;   // compressed frame
+    size_t      dstCap;
+}frameIndex;
+
+/* Compress what raw holds as the next frame and write it to out */
+static bool frameFlush(outBuf *raw, outBuf *out, frameIndex *fi,
+                       uint32_t first, uint32_t n)
+{
+    if (raw->err)
+        return 0;
+    if (fi->n == fi->cap) {
+        uint32_t cap = fi->cap ? fi->cap * 2 : 64;
+        frameEntry *tmp = (frameEntry *)memRealloc(MEM_IO, fi->e,
+                                                   sizeof(frameEntry) * cap);
+        if (tmp == NULL) {
+            log_msg_default;
+            return 0;
+        }
+        fi->e = tmp;
+        fi->cap = cap;
+    }
+    size_t need = LZMA_BUF_BOUND((size_t)raw->len);
+    if (need > fi->dstCap) {
+        uint8_t *tmp = (uint8_t *)memRealloc(MEM_IO, fi->dst, need);
+        if (tmp == NULL) {
+            log_msg_default;
+            return 0;
+        }
+        fi->dst = tmp;
+        fi->dstCap = need;
+    }
+
+    frameEntry *e = &fi->e[fi->n];
+    size_t packed = fi->dstCap;
+    if (!compress_buf(fi->dst, &packed, (const uint8_t *)raw->buf, raw->len,
+                      e->props))
+        return 0;
+    e->first = first;
+    e->n = n;
+    e->off = fi->off;
+    e->packed = packed;
+    e->raw = raw->len;
+    fi->n++;
+    fi->off += packed;
+    raw->len = 0;
+
+    outBufWrite(out, fi->dst, packed);
+    return !out->err;
+}
+
+bool partToFrames(chain *ch, uint32_t start, uint32_t end, uint32_t part,
+                  FILE *fp, uint32_t nBlock, uint32_t nBytes)
+{
+    outBuf raw, out;
+    frameIndex fi = {NULL, 0, 0, FRAME_HEADER, NULL, 0};
+    binBlock h;
+    uint32_t i, first = start;
+    bool ok;
+
+    if (nBlock == 0)
+        nBlock = FRAME_BLOCKS;
+    if (!outBufInit(&out, fp))
+        return 0;
+    if (!outBufInit(&raw, NULL, nBytes + OUTBUF_SIZE)) {
+        outBufFree(&out);
+        return 0;
+    }
+
+    outBufWrite(&out, FRAME_MAGIC, 4);
+    outBufPut16(&out, FRAME_VERSION);
+    outBufPut16(&out, 0);
+    outBufPut32(&out, part);
+    outBufPut32(&out, start);
+
+    // head frame, the binary part header and the dict
+    partHeadBin(ch, end - start, part, &raw);
+    ok = frameFlush(&raw, &out, &fi, start, 0);
+
+    // every frame is a run of its own, it decodes without the others
+    binBlockStart(&h);
+    for (i = start; i < end && ok; ) {
+        uint32_t run, j;
+        block **bx = chainSpan(ch, i, end, &run);
+        for (j = 0; j < run && ok; j++) {
+            blockToBin(bx[j], &h, &raw);
+            if (i + j + 1 - first == nBlock || raw.len >= nBytes) {
+                ok = frameFlush(&raw, &out, &fi, first, i + j + 1 - first);
+                first = i + j + 1;
+                binBlockStart(&h);
+            }
+        }
+        i += run;
+    }
+    if (ok && first < end)
+        ok = frameFlush(&raw, &out, &fi, first, end - first);
+
+    if (ok) {
+        for (i = 0; i < fi.n; i++) {
+            outBufPut32(&out, fi.e[i].first);
+            outBufPut32(&out, fi.e[i].n);
+            outBufPut64(&out, fi.e[i].off);
+            outBufPut32(&out, fi.e[i].packed);
+            outBufPut32(&out, fi.e[i].raw);
+            outBufWrite(&out, fi.e[i].props, sizeof(fi.e[i].props));
+        }
+        outBufPut64(&out, fi.off);
+        outBufPut32(&out, fi.n);
+        outBufWrite(&out, FRAME_INDEX_MAGIC, 4);
+    }
+
+    memFree(MEM_IO, fi.e);
+    memFree(MEM_IO, fi.dst);
+    outBufFree(&raw);
+    return outBufFree(&out) && ok;
+}
+
+/* Read @p len bytes at @p off, under the lock so threads can share fp */
+static bool frameRead(frameFile *ff, uint64_t off, void *buf, size_t len)
+{
+    pthread_mutex_lock(&ff->lock);
+    bool ok = fseek(ff->fp, off, SEEK_SET) == 0
+        && fread(buf, 1, len, ff->fp) == len;
+    pthread_mutex_unlock(&ff->lock);
+    return ok;
+}
+
+/* Decompress frame @p i into a MEM_IO buffer of idx[i].raw bytes */
+static uint8_t *frameDecode(frameFile *ff, uint32_t i)
+{
+    frameEntry *e = &ff->idx[i];
+    uint8_t *packed = (uint8_t *)memAlloc(MEM_IO, e->packed ? e->packed : 1);
+    uint8_t *raw = (uint8_t *)memAlloc(MEM_IO, e->raw ? e->raw : 1);
+    if (packed == NULL || raw == NULL) {
+        log_msg_default;
+    } else if (!frameRead(ff, e->off, packed, e->packed)) {
+        log_msg_custom("Reading a frame failed");
+    } else if (decompress_buf(raw, e->raw, packed, e->packed, e->props)) {
+        memFree(MEM_IO, packed);
+        return raw;
+    }
+    memFree(MEM_IO, packed);
+    memFree(MEM_IO, raw);
+    return NULL;
+}
+
+/* Read the trailer and the index, checking every frame is in the file */
+static bool frameReadIndex(frameFile *ff)
+{
+    uint8_t buf[FRAME_TRAILER > FRAME_HEADER ? FRAME_TRAILER : FRAME_HEADER];
+    binCursor c;
+    long size;
+
+    if (fseek(ff->fp, 0, SEEK_END) || (size = ftell(ff->fp)) < 0
+        || size < FRAME_HEADER + FRAME_TRAILER)
+        return 0;
+
+    if (!frameRead(ff, 0, buf, FRAME_HEADER) || memcmp(buf, FRAME_MAGIC, 4))
+        return 0;
+    c.p = buf + 4;
+    c.end = buf + FRAME_HEADER;
+    if (binGet16(&c) != FRAME_VERSION)
+        return 0;
+    binGet16(&c); // flags
+    ff->part = binGet32(&c);
+    ff->first = binGet32(&c);
+
+    if (!frameRead(ff, size - FRAME_TRAILER, buf, FRAME_TRAILER)
+        || memcmp(buf + 12, FRAME_INDEX_MAGIC, 4))
+        return 0;
+    c.p = buf;
+    c.end = buf + FRAME_TRAILER;
+    uint64_t idxOff = binGet64(&c);
+    ff->nFrame = binGet32(&c);
+    if (ff->nFrame == 0 || idxOff > (uint64_t)size
+        || (size - FRAME_TRAILER - idxOff) / FRAME_ENTRY != ff->nFrame)
+        return 0;
+
+    size_t len = (size_t)ff->nFrame * FRAME_ENTRY;
+    uint8_t *data = (uint8_t *)memAlloc(MEM_IO, len);
+    ff->idx = (frameEntry *)memAlloc(MEM_CHAIN, sizeof(frameEntry) * ff->nFrame);
+    bool ok = data && ff->idx && frameRead(ff, idxOff, data, len);
+    c.p = data;
+    c.end = data + len;
+    for (uint32_t i = 0; ok && i < ff->nFrame; i++) {
+        frameEntry *e = &ff->idx[i];
+        e->first = binGet32(&c);
+        e->n = binGet32(&c);
+        e->off = binGet64(&c);
+        e->packed = binGet32(&c);
+        e->raw = binGet32(&c);
+        memcpy(e->props, c.p, sizeof(e->props));
+        c.p += sizeof(e->props);
+        // frames follow each other in block order from the header's
+        // first, frameWorker indexes with e->first - ff->first
+        ok = e->off >= FRAME_HEADER && e->off + e->packed <= idxOff
+            && (i > 0 || e->n == 0)
+            && (uint64_t)e->first == (uint64_t)ff->first + ff->nBlock
+            && e->n <= MAX_U32 - ff->nBlock
+            && (uint64_t)e->first + e->n <= MAX_U32;
+        if (ok)
+            ff->nBlock += e->n;
+    }
+    memFree(MEM_IO, data);
+    return ok;
+}
+
+frameFile *frameOpen(const char *path, chain *ch)
+{
+    frameFile *ff = (frameFile *)memAlloc(MEM_CHAIN, sizeof(frameFile));
+    if (ff == NULL) {
+        log_msg_default;
+        return NULL;
+    }
+    ff->idx = NULL;
+    ff->map = NULL;
+    ff->nMap = 0;
+    ff->nBlock = 0;
+    pthread_mutex_init(&ff->lock, NULL);
+    ff->fp = fopen(path, "rb");
+    if (ff->fp == NULL) {
+        char msg[80];
+        snprintf(msg, 79, "Opening [%s] failed", path);
+        log_msg_custom(msg);
+        frameClose(ff);
+        return NULL;
+    }
+    if (!frameReadIndex(ff)) {
+        log_msg_custom("Framed part header or index is corrupt");
+        frameClose(ff);
+        return NULL;
+    }
+
+    // head frame: binary part header and dict
+    uint8_t *head = frameDecode(ff, 0);
+    binCursor c = {head, head + ff->idx[0].raw};
+    binPart h;
+    bool ok = head && binPartHeader(&c, &h) && h.nBlock == ff->nBlock
+        && binDictMap(&c, h.nDict, ch, &ff->map);
+    ff->nMap = ok ? h.nDict : 0;
+    memFree(MEM_IO, head);
+    if (!ok) {
+        log_msg_custom("Framed part head frame is corrupt");
+        frameClose(ff);
+        return NULL;
+    }
+    return ff;
+}
+
+void frameClose(frameFile *ff)
+{
+    if (ff == NULL)
+        return;
+    if (ff->fp)
+        fclose(ff->fp);
+    memFree(MEM_CHAIN, ff->idx);
+    memFree(MEM_PARSER, ff->map);
+    pthread_mutex_destroy(&ff->lock);
+    memFree(MEM_CHAIN, ff);
+}
+
+uint32_t frameFind(const frameFile *ff, uint32_t n)
+{
+    // binary search over the block frames, idx[0] is the head
+    uint32_t lo = 1, hi = ff->nFrame;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (n < ff->idx[mid].first)
+            hi = mid;
+        else if (n - ff->idx[mid].first >= ff->idx[mid].n)
+            lo = mid + 1;
+        else
+            return mid;
+    }
+    return 0;
+}
+
+block *frameReadBlock(frameFile *ff, uint32_t n)
+{
+    uint32_t i = frameFind(ff, n);
+    if (i == 0)
+        return NULL;
+    uint8_t *raw = frameDecode(ff, i);
+    if (raw == NULL)
+        return NULL;
+
+    binCursor c = {raw, raw + ff->idx[i].raw};
+    binBlock h;
+    uint32_t k;
+    binBlockStart(&h);
+    for (k = ff->idx[i].first; k < n; k++) {
+        if (!binBlockSkip(&c, &h))
+            break;
+    }
+    block *bx = k == n ? bin2Block(&c, &h, ff->map, ff->nMap) : NULL;
+    memFree(MEM_IO, raw);
+    return bx;
+}
+
+/* Arguments of a frameLoad thread */
+typedef struct
+{
+    frameFile *ff;
+    block    **bx;    // one slot per block of the part, shared
+    uint32_t  *next;  // next frame to take, shared
+    bool       ok;
+}frameWork;
+
+static void *frameWorker(void *args)
+{
+    frameWork *fw = (frameWork *)args;
+    frameFile *ff = fw->ff;
+    uint32_t i;
+
+    while ((i = __atomic_fetch_add(fw->next, 1, __ATOMIC_RELAXED))
+           < ff->nFrame) {
+        frameEntry *e = &ff->idx[i];
+        uint8_t *raw = frameDecode(ff, i);
+        if (raw == NULL) {
+            fw->ok = 0;
+            continue;
+        }
+        binCursor c = {raw, raw + e->raw};
+        binBlock h;
+        binBlockStart(&h);
+        for (uint32_t k = 0; k < e->n; k++) {
+            block *bx = bin2Block(&c, &h, ff->map, ff->nMap);
+            if (bx == NULL) {
+                fw->ok = 0;
+                break;
+            }
+            fw->bx[e->first - ff->first + k] = bx;
+        }
+        memFree(MEM_IO, raw);
+    }
+    return NULL;
+}
+
+bool frameLoad(frameFile *ff, chain *ch, uint8_t threads)
+{
+    if (threads == 0)
+        threads = 1;
+    if (ff->nBlock == 0)
+        return 1;
+    // built aside, a failed frame must not leave holes in the chain
+    block **bx = (block **)memAlloc(MEM_CHAIN, sizeof(block *) * ff->nBlock);
+    if (bx == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    memset(bx, 0, sizeof(block *) * ff->nBlock);
+
+    uint32_t next = 1, i; // frame 0 is the head, already read
+    frameWork fw[threads];
+    poolGroup g;
+    bool ok = 1;
+    poolGroupInit(&g);
+    for (i = 0; i < threads; i++) {
+        fw[i].ff = ff;
+        fw[i].bx = bx;
+        fw[i].next = &next;
+        fw[i].ok = 1;
+    }
+    // the calling thread is the last worker
+    for (i = 0; i < threads - 1u; i++)
+        poolSubmit(&g, frameWorker, &fw[i]);
+    frameWorker(&fw[threads - 1]);
+    poolWait(&g);
+    for (i = 0; i < threads; i++)
+        ok &= fw[i].ok;
+
+    uint32_t base = ok ? chainReserve(ch, ff->nBlock) : MAX_U32;
+    if (ok && base == MAX_U32) {
+        log_msg_custom("Failed to reserve the blocks of a framed part");
+        ok = 0;
+    }
+    for (i = 0; i < ff->nBlock; i++) {
+        if (ok)
+            chainPublish(ch, base + i, bx[i]);
+        else if (bx[i] != NULL)
+            deleteBlock(bx[i]);
+    }
+    memFree(MEM_CHAIN, bx);
+    if (!ok)
+        log_msg_custom("Loading a framed part failed");
+    return ok;
+}
@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "chainview.h"
+#include "alib.h"
+#include "strtab.h"
+#include "memstat.h"
+#include "log.h"
+
+/* Map the whole file read only, cv->map is NULL on failure */
+static void viewMap(chainView *cv, const char *path)
+{
+    cv->map = NULL;
+    cv->len = 0;
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    cv->file = file;
+    cv->fmap = NULL;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size)
+        || size.QuadPart == 0)
+        return;
+    cv->fmap = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (cv->fmap == NULL)
+        return;
+    cv->map = (const uint8_t *)MapViewOfFile(cv->fmap, FILE_MAP_READ, 0, 0, 0);
+    cv->len = cv->map ? (size_t)size.QuadPart : 0;
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            // the index is built front to back
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            cv->map = (const uint8_t *)p;
+            cv->len = st.st_size;
+        }
+    }
+    close(fd); // the mapping keeps the file
+#endif
+}
+
+static void viewUnmap(chainView *cv)
+{
+#ifdef _WIN32
+    if (cv->map)
+        UnmapViewOfFile(cv->map);
+    if (cv->fmap)
+        CloseHandle(cv->fmap);
+    if (cv->file != INVALID_HANDLE_VALUE)
+        CloseHandle(cv->file);
+#else
+    if (cv->map)
+        munmap((void *)cv->map, cv->len);
+#endif
+    cv->map = NULL;
+}
+
+/* Record where every dict entry and block starts, the bodies are only
+ * jumped over, a block is checked when it is read */
+static bool viewIndex(chainView *cv)
+{
+    binCursor c = {cv->map, cv->map + cv->len};
+    uint32_t i;
+
+    if (!binPartHeader(&c, &cv->hdr))
+        return 0;
+    // every entry takes at least 2 bytes and every block a header
+    if (cv->hdr.nDict > cv->len / 2
+        || cv->hdr.nBlock > cv->len / CHAIN_BIN_BLOCK) {
+        log_msg_custom("Binary part header is corrupt");
+        return 0;
+    }
+
+    cv->dict = (size_t *)memAlloc(MEM_CHAIN, sizeof(size_t)
+                                  * (cv->hdr.nDict + 1));
+    cv->block = (size_t *)memAlloc(MEM_CHAIN, sizeof(size_t)
+                                   * (cv->hdr.nBlock + 1));
+    cv->head = (binBlock *)memAlloc(MEM_CHAIN, sizeof(binBlock)
+                                    * (cv->hdr.nBlock + 1));
+    if (cv->dict == NULL || cv->block == NULL || cv->head == NULL) {
+        log_msg_default;
+        return 0;
+    }
+
+    for (i = 0; i < cv->hdr.nDict; i++) {
+        std::string_view url;
+        cv->dict[i] = c.p - cv->map;
+        if (!binDictEntry(&c, &url)) {
+            log_msg_custom("Binary dict truncated");
+            return 0;
+        }
+    }
+    binBlock h;
+    binBlockStart(&h);
+    for (i = 0; i < cv->hdr.nBlock; i++) {
+        if (!binBlockSkip(&c, &h)) {
+            log_msg_custom("Binary block truncated");
+            return 0;
+        }
+        cv->block[i] = c.p - h.body - cv->map;
+        cv->head[i] = h;
+    }
+    return 1;
+}
+
+chainView *chainViewOpen(const char *path)
+{
+    chainView *cv = (chainView *)memAlloc(MEM_CHAIN, sizeof(chainView));
+    if (cv == NULL) {
+        log_msg_default;
+        return NULL;
+    }
+    cv->block = NULL;
+    cv->head = NULL;
+    cv->dict = NULL;
+    cv->tr = NULL;
+
+    viewMap(cv, path);
+    if (cv->map == NULL) {
+        char msg[80];
+        snprintf(msg, 79, "Mapping [%s] failed", path);
+        log_msg_custom(msg);
+        chainViewClose(cv);
+        return NULL;
+    }
+    if (!viewIndex(cv)) {
+        chainViewClose(cv);
+        return NULL;
+    }
+    return cv;
+}
+
+void chainViewClose(chainView *cv)
+{
+    if (cv == NULL)
+        return;
+    viewUnmap(cv);
+    memFree(MEM_CHAIN, cv->block);
+    memFree(MEM_CHAIN, cv->head);
+    memFree(MEM_CHAIN, cv->dict);
+    memFree(MEM_CHAIN, cv->tr);
+    memFree(MEM_CHAIN, cv);
+}
+
+bool chainViewBlock(const chainView *cv, uint32_t i, binBlock *h,
+                    binCursor *packs)
+{
+    uint32_t strBytes;
+    if (i >= cv->hdr.nBlock)
+        return 0;
+    // the header was decoded when indexing, the body is checked now
+    packs->p = cv->map + cv->block[i];
+    packs->end = packs->p + cv->head[i].body;
+    if (!binBlockBody(packs->p, &cv->head[i], &strBytes)) {
+        log_msg_custom("Binary block corrupt");
+        return 0;
+    }
+    *h = cv->head[i];
+    return 1;
+}
+
+/* blockSrc::load of the blocks of chainViewLoad, the block at @p at is
+ * checked here, on first use, not when indexing */
+static pack **viewPacks(const void *ctx, const uint8_t *at, uint16_t nPack)
+{
+    const chainView *cv = (const chainView *)ctx;
+    size_t off = at - cv->map;
+    uint32_t lo = 0, hi = cv->hdr.nBlock, strBytes;
+    binPack pk;
+
+    // the block starting at off, cv->block is ascending
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (cv->block[mid] <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    if (lo >= cv->hdr.nBlock || cv->block[lo] != off
+        || cv->head[lo].nPack != nPack
+        || !binBlockBody(at, &cv->head[lo], &strBytes)) {
+        log_msg_custom("Binary block corrupt");
+        return NULL;
+    }
+    binCursor c = {at, at + cv->head[lo].body};
+
+    // the array, the packs, then the strings, in one allocation
+    size_t head = sizeof(pack *) * nPack + sizeof(pack) * nPack;
+    char *mem = (char *)memAlloc(MEM_BLOCK, head + strBytes + 1);
+    if (mem == NULL) {
+        log_msg_default;
+        return NULL;
+    }
+    pack **packs = (pack **)mem;
+    pack *px = (pack *)(mem + sizeof(pack *) * nPack);
+    char *str = mem + head;
+
+    for (uint16_t i = 0; i < nPack; i++, px++) {
+        binPackGet(&c, &pk);
+        memset(px->info, 0, sizeof(px->info));
+        memcpy(px->info, pk.dn.data(), pk.dn.size() < 5 ? pk.dn.size() : 5);
+        px->dn = str;
+        memcpy(str, pk.dn.data(), pk.dn.size());
+        str[pk.dn.size()] = '\0';
+        str += pk.dn.size() + 1;
+        px->xl = pk.xl;
+        px->tr = pk.tr < cv->hdr.nDict ? cv->tr[pk.tr] : STRTAB_NONE;
+        px->xtType = pk.xtType;
+        if (pk.xtType == XT_STR) {
+            px->xt.str = str;
+            memcpy(str, pk.xtStr.data(), pk.xtStr.size());
+            str[pk.xtStr.size()] = '\0';
+            str += pk.xtStr.size() + 1;
+        } else {
+            memcpy(px->xt.hash.b, pk.hash, sizeof(px->xt.hash.b));
+        }
+        packs[i] = px;
+    }
+    return packs;
+}
+
+bool chainViewLoad(chainView *cv, chain *ch)
+{
+    uint32_t i, nBlock = cv->hdr.nBlock;
+    if (cv->tr != NULL) {
+        log_msg_custom("View loaded already");
+        return 0;
+    }
+    cv->tr = (uint32_t *)memAlloc(MEM_CHAIN, sizeof(uint32_t)
+                                  * (cv->hdr.nDict + 1));
+    if (cv->tr == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    for (i = 0; i < cv->hdr.nDict; i++) {
+        std::string_view url = chainViewTracker(cv, i);
+        cv->tr[i] = strtabIntern(&ch->trackers, url.data(), url.size());
+    }
+    cv->src.load = viewPacks;
+    cv->src.ctx = cv;
+
+    block **bx = (block **)memAlloc(MEM_PARSER, sizeof(block *) * (nBlock + 1));
+    bool ok = bx != NULL;
+    for (i = 0; ok && i < nBlock; i++) {
+        bx[i] = (block *)memAlloc(MEM_BLOCK, sizeof(block));
+        if (bx[i] == NULL)
+            break;
+        const binBlock &h = cv->head[i];
+        memset(bx[i], 0, sizeof(block));
+        bx[i]->time = h.time;
+        bx[i]->crc = h.crc;
+        bx[i]->nPack = h.nPack;
+        bx[i]->n = h.n;
+        bx[i]->key = h.key;
+        bx[i]->src = &cv->src;
+        bx[i]->lazy = cv->map + cv->block[i];
+    }
+    ok = ok && i == nBlock;
+    uint32_t first = ok && nBlock ? chainReserve(ch, nBlock) : 0;
+    ok = ok && first != MAX_U32;
+    for (uint32_t j = 0; bx && j < i; j++) {
+        if (ok)
+            chainPublish(ch, first + j, bx[j]);
+        else
+            deleteBlock(bx[j]);
+    }
+    if (!ok) {
+        log_msg_custom("Loading the view failed");
+        memFree(MEM_CHAIN, cv->tr);
+        cv->tr = NULL;
+    }
+    memFree(MEM_PARSER, bx);
+    return ok;
+}
+
+std::string_view chainViewTracker(const chainView *cv, uint32_t tr)
+{
+    std::string_view url;
+    if (tr >= cv->hdr.nDict)
+        return url;
+    binCursor c = {cv->map + cv->dict[tr], cv->map + cv->len};
+    binDictEntry(&c, &url);
+    return url;
+}
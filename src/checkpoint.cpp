@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <limits.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#ifndef PATH_MAX
+#define PATH_MAX MAX_PATH
+#endif//PATH_MAX
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif//WINDOWS
+
+#include "checkpoint.h"
+#include "chainframe.h"
+#include "alib.h"
+#include "memstat.h"
+#include "log.h"
+
+/* One Mseg line */
+typedef struct
+{
+    uint32_t first;
+    uint32_t n;
+    char     file[PATH_MAX];
+}manifestSeg;
+
+/* Contents of a manifest */
+typedef struct
+{
+    uint32_t     last;
+    uint32_t     nSeg;
+    manifestSeg *seg;
+}manifest;
+
+/* Push fp through the os caches to the disk */
+static bool fileSync(FILE *fp)
+{
+    if (fflush(fp) != 0)
+        return 0;
+#ifdef _WIN32
+    return FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(fp))) != 0;
+#else
+    return fsync(fileno(fp)) == 0;
+#endif
+}
+
+/* Make the entries of the directory holding path durable, the rename
+ * of the manifest is only safe once its directory is synced. Windows
+ * has no directory handle to flush, NTFS journals the rename. */
+static bool dirSync(const char *path)
+{
+#ifdef _WIN32
+    (void)path;
+    return 1;
+#else
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s",
+                 (int)(slash - path) + (slash == path), path);
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#endif
+}
+
+/* Read base.mf, a missing file is an empty manifest
+ *
+ * @return 0 on a corrupt manifest or malloc failure
+ */
+static bool manifestRead(const char *base, manifest *mf)
+{
+    char path[PATH_MAX], s[PATH_MAX + 64];
+    uint32_t cap = 0;
+    mf->last = 0;
+    mf->nSeg = 0;
+    mf->seg = NULL;
+
+    snprintf(path, sizeof(path), "%s.mf", base);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return 1;
+
+    bool ok = 1;
+    while (ok && fgets(s, sizeof(s), fp) != NULL) {
+        char *data = strstr(s, ": ");
+        if (s[0] != 'M' || data == NULL)
+            continue;
+        switch (s[1]) {
+        case 'v': // Mver
+            ok = strtoul(data + 2, NULL, 10) == MANIFEST_VERSION;
+            break;
+        case 'l': // Mlast
+            mf->last = strtoul(data + 2, NULL, 10);
+            break;
+        case 's': { // Mseg
+            if (mf->nSeg == cap) {
+                cap = cap ? cap * 2 : 16;
+                manifestSeg *tmp = (manifestSeg *)memRealloc(MEM_PARSER, mf->seg,
+                                                             sizeof(manifestSeg) * cap);
+                if (tmp == NULL) {
+                    log_msg_default;
+                    ok = 0;
+                    break;
+                }
+                mf->seg = tmp;
+            }
+            manifestSeg *sg = &mf->seg[mf->nSeg];
+            char *end;
+            sg->first = strtoul(data + 2, &end, 10);
+            sg->n = strtoul(end, &end, 10);
+            char *comma = strrchr(end, ',');
+            if (*end != ' ' || comma == NULL
+                || comma - end - 1 >= (long)sizeof(sg->file)) {
+                ok = 0;
+                break;
+            }
+            memcpy(sg->file, end + 1, comma - end - 1);
+            sg->file[comma - end - 1] = '\0';
+            // segments follow each other
+            ok = sg->first == (mf->nSeg ? mf->seg[mf->nSeg - 1].first
+                               + mf->seg[mf->nSeg - 1].n : 0);
+            mf->nSeg++;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    fclose(fp);
+
+    if (ok && mf->last != (mf->nSeg ? mf->seg[mf->nSeg - 1].first
+                           + mf->seg[mf->nSeg - 1].n : 0))
+        ok = 0;
+    if (!ok) {
+        log_msg_custom("Manifest is corrupt");
+        memFree(MEM_PARSER, mf->seg);
+        mf->seg = NULL;
+    }
+    return ok;
+}
+
+/* Write the manifest with one more segment and swap it in */
+static bool manifestWrite(const char *base, const manifest *mf,
+                          const manifestSeg *add)
+{
+    char path[PATH_MAX], tmp[PATH_MAX + 4];
+    snprintf(path, sizeof(path), "%s.mf", base);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    fprintf(fp, "Mver : %u,\nMlast: %u,\n", MANIFEST_VERSION,
+            add->first + add->n);
+    for (uint32_t i = 0; i < mf->nSeg; i++)
+        fprintf(fp, "Mseg : %u %u %s,\n", mf->seg[i].first, mf->seg[i].n,
+                mf->seg[i].file);
+    fprintf(fp, "Mseg : %u %u %s,\n", add->first, add->n, add->file);
+
+    bool ok = !ferror(fp) && fileSync(fp);
+    ok &= fclose(fp) == 0;
+#ifdef _WIN32
+    // rename does not replace an existing file on windows, removing it
+    // first would leave no manifest if we crashed in between
+    ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING
+                           | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    ok = ok && rename(tmp, path) == 0;
+#endif
+    ok = ok && dirSync(path);
+    if (!ok)
+        log_msg_custom("Writing the manifest failed");
+    return ok;
+}
+
+bool chainCheckpoint(chain *ch, const char *base, uint32_t *saved)
+{
+    manifest mf;
+    manifestSeg add;
+    uint32_t size = chainSize(ch);
+
+    if (saved)
+        *saved = 0;
+    if (!manifestRead(base, &mf))
+        return 0;
+    if (mf.last > size) {
+        log_msg_custom("Manifest has more blocks than the chain");
+        memFree(MEM_PARSER, mf.seg);
+        return 0;
+    }
+    if (mf.last == size) {
+        memFree(MEM_PARSER, mf.seg);
+        return 1;
+    }
+
+    add.first = mf.last;
+    add.n = size - mf.last;
+    snprintf(add.file, sizeof(add.file), "%s.%u.tcf", base, mf.nSeg);
+
+    FILE *fp = fopen(add.file, "wb");
+    bool ok = fp != NULL;
+    if (ok) {
+        ok = partToFrames(ch, add.first, size, mf.nSeg + 1, fp)
+            && fileSync(fp);
+        ok &= fclose(fp) == 0;
+    }
+    // the manifest only changes once the segment is complete
+    ok = ok && manifestWrite(base, &mf, &add);
+    if (!ok)
+        log_msg_custom("Checkpoint failed");
+    else if (saved)
+        *saved = add.n;
+
+    memFree(MEM_PARSER, mf.seg);
+    return ok;
+}
+
+chain *chainRestore(const char *base)
+{
+    manifest mf;
+    if (!manifestRead(base, &mf))
+        return NULL;
+    if (mf.nSeg == 0) {
+        log_msg_custom("No checkpoint to restore");
+        return NULL;
+    }
+
+    chain *ch = newChain();
+    bool ok = ch != NULL;
+    for (uint32_t i = 0; ok && i < mf.nSeg; i++) {
+        frameFile *ff = frameOpen(mf.seg[i].file, ch);
+        ok = ff && ff->nBlock == mf.seg[i].n
+            && frameLoad(ff, ch, FRAME_THREADS);
+        frameClose(ff);
+    }
+    memFree(MEM_PARSER, mf.seg);
+    if (ok && chainVerify(ch, 0, chainSize(ch), VERIFY_THREADS))
+        ok = 0;
+
+    if (!ok && ch) {
+        log_msg_custom("Restoring the checkpoint failed");
+        deleteChain(ch);
+        memFree(MEM_CHAIN, ch);
+        ch = NULL;
+    }
+    return ch;
+}
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78 // reflected Castagnoli polynomial
+
+static uint32_t crcTable[8][256];
+static uint32_t (*crcImpl)(uint32_t, const uint8_t *, size_t);
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+/* Slicing by 8: 8 bytes per step, one lookup per byte */
+static uint32_t crcSw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+        crc = crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    for (; len >= 8; len -= 8, p += 8) {
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff]
+            ^ crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24]
+            ^ crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff]
+            ^ crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+    }
+    for (; len > 0; len--)
+        crc = crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crcHw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    for (; len > 0 && ((uintptr_t)p & 7); len--)
+        crc = _mm_crc32_u8(crc, *p++);
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+#else
+    for (; len >= 4; len -= 4, p += 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+#endif
+    for (; len > 0; len--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif//CRC32C_X86
+
+static void crcInit(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        crcTable[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crcTable[t][i] = crcTable[0][crcTable[t - 1][i] & 0xff]
+                ^ (crcTable[t - 1][i] >> 8);
+
+    uint32_t (*impl)(uint32_t, const uint8_t *, size_t) = crcSw;
+#ifdef CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        impl = crcHw;
+#endif
+    // crc32c skips pthread_once once this is set, the tables come first
+    __atomic_store_n(&crcImpl, impl, __ATOMIC_RELEASE);
+}
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    uint32_t (*impl)(uint32_t, const uint8_t *, size_t)
+        = __atomic_load_n(&crcImpl, __ATOMIC_ACQUIRE);
+    if (impl == NULL) {
+        pthread_once(&crcOnce, crcInit);
+        impl = crcImpl;
+    }
+    return ~impl(~crc, (const uint8_t *)data, len);
+}
+
+uint32_t crc32cTable(uint32_t crc, const void *data, size_t len)
+{
+    pthread_once(&crcOnce, crcInit);
+    return ~crcSw(~crc, (const uint8_t *)data, len);
+}
+
+bool crc32cHw(void)
+{
+    pthread_once(&crcOnce, crcInit);
+    return crcImpl != crcSw;
+}
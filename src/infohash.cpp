@@ -0,0 +1,90 @@
+#include <string.h>
+#include <strings.h>
+
+#include "infohash.h"
+
+/* Value of a hex digit, -1 if it isn't one */
+static inline int hexVal(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Value of a base32 digit (RFC 4648), -1 if it isn't one */
+static inline int b32Val(char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a';
+    if (c >= '2' && c <= '7') return c - '2' + 26;
+    return -1;
+}
+
+uint8_t xtParse(const char *xt, uint32_t len, infohash *out)
+{
+    if (len < XT_BTIH_PREFIX_LEN
+        || strncasecmp(xt, XT_BTIH_PREFIX, XT_BTIH_PREFIX_LEN) != 0)
+        return XT_STR;
+    xt += XT_BTIH_PREFIX_LEN;
+    len -= XT_BTIH_PREFIX_LEN;
+
+    if (len == 40) {
+        for (int i = 0; i < 20; i++) {
+            int hi = hexVal(xt[2 * i]), lo = hexVal(xt[2 * i + 1]);
+            if (hi < 0 || lo < 0)
+                return XT_STR;
+            out->b[i] = (uint8_t)(hi << 4 | lo);
+        }
+        return XT_BTIH_HEX;
+    }
+    if (len == 32) {
+        // 8 digits of 5 bits make 5 bytes
+        for (int i = 0; i < 4; i++) {
+            uint64_t acc = 0;
+            for (int j = 0; j < 8; j++) {
+                int v = b32Val(xt[8 * i + j]);
+                if (v < 0)
+                    return XT_STR;
+                acc = acc << 5 | v;
+            }
+            for (int j = 0; j < 5; j++)
+                out->b[5 * i + j] = (uint8_t)(acc >> (8 * (4 - j)));
+        }
+        return XT_BTIH_B32;
+    }
+    return XT_STR;
+}
+
+uint32_t xtFormat(const pack *pk, char *buf, const char **out)
+{
+    static const char hex[] = "0123456789abcdef";
+    static const char b32[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+    const uint8_t *b = pk->xt.hash.b;
+    char *p = buf + XT_BTIH_PREFIX_LEN;
+
+    switch (pk->xtType) {
+    case XT_BTIH_HEX:
+        for (int i = 0; i < 20; i++) {
+            *p++ = hex[b[i] >> 4];
+            *p++ = hex[b[i] & 15];
+        }
+        break;
+    case XT_BTIH_B32:
+        for (int i = 0; i < 4; i++) {
+            uint64_t acc = 0;
+            for (int j = 0; j < 5; j++)
+                acc = acc << 8 | b[5 * i + j];
+            for (int j = 7; j >= 0; j--)
+                *p++ = b32[(acc >> (5 * j)) & 31];
+        }
+        break;
+    default:
+        *out = pk->xt.str ? pk->xt.str : "";
+        return strlen(*out);
+    }
+    memcpy(buf, XT_BTIH_PREFIX, XT_BTIH_PREFIX_LEN);
+    *p = '\0';
+    *out = buf;
+    return p - buf;
+}
@@ -22,6 +22,7 @@
 /* include */
 #include "lzma_wrapper.h"
 #include "log.h"
+#include "memstat.h"
 /* extern */
 #include "C/LzmaLib.h"
 #include "C/7zTypes.h"
@@ -40,7 +41,9 @@ static void *SzAlloc(void *p, //!< Not implemented
                      )
 {
     (void)p; // silence unused var warning
-    return MyAlloc(size); // just a malloc call...
+    if (size == 0)
+        return NULL; // same as MyAlloc
+    return memAlloc(MEM_LZMA, size);
 }
 
 /**
@@ -52,7 +55,7 @@ static void SzFree(void *p, //!< Not implemented
                    )
 {
     (void)p; // silence unused var warning
-    MyFree(address); // just a free call ... 
+    memFree(MEM_LZMA, address);
 }
 
 /** @brief Struct implementation */
@@ -173,8 +176,7 @@ static unsigned long get_header(FILE *fd, //!< Fp to 7z file
         return 0;
     for (int i = 0; i < 8; i++) {
         /* get file size, stored little endian after prop */
-        rt |= (unsigned long)(props_header[LZMA_PROPS_SIZE + i]
-                             << (i * 8));
+        rt |= (unsigned long)props_header[LZMA_PROPS_SIZE + i] << (i * 8);
     }
     return rt;
 }
@@ -307,11 +309,19 @@ int decompress_file(const char *in_path,
     return 1;
 }
 
-int compress_data_incr(FILE *input, FILE *output, const CLzmaEncProps *args)
+/** @brief Write the header and encode everything read from @p in
+ *
+ * @return
+ * SZ_OK - success\n
+ * LZMA error code otherwise
+ */
+static int encode_stream(ISeqInStream *in, //!< Data to compress
+                         FILE *output, //!< Fp to output file
+                         unsigned long file_size, //!< Stored in the header
+                         const CLzmaEncProps *args //!< Arguments to pass to the encode fn
+                         )
 {
     int rt = 1;
-    /* iseqinstream and iseqoutstream objects */
-    seq_in_stream i_stream = {{read_data}, input};
     seq_out_stream o_stream = {{write_data}, output};
     /* CLzmaEncHandle is just a pointer (void *) */
     CLzmaEncHandle enc_hand = LzmaEnc_Create(&g_Alloc);
@@ -323,11 +333,12 @@ int compress_data_incr(FILE *input, FILE *output, const CLzmaEncProps *args)
     /* 5 bytes for lzma prop + 8 bytes for filesize */
     unsigned char props_header[LZMA_PROPS_SIZE_FILESIZE];
     SizeT props_size = LZMA_PROPS_SIZE; // size of prop
-    unsigned long file_size = get_file_size_c(input); // filesize
     CLzmaEncProps prop_info; // info for prop, control vals for comp
     /* note the prop is the header of the compressed file */
     LzmaEncProps_Init(&prop_info);
     assign_prop_vals(&prop_info, args);
+    if (file_size == LZMA_SIZE_UNKNOWN)
+        prop_info.writeEndMark = 1; // the decoder needs it to stop
     rt = LzmaEnc_SetProps(enc_hand, &prop_info);
     if (rt != SZ_OK)
         goto end;
@@ -344,10 +355,12 @@ int compress_data_incr(FILE *input, FILE *output, const CLzmaEncProps *args)
     if (rt == SZ_OK)
         rt = LzmaEnc_Encode(enc_hand,
                             &(o_stream.out_stream),
-                            &(i_stream.in_stream),
+                            in,
                             NULL, &g_Alloc, &g_Alloc);
+    if (rt != SZ_OK)
+        goto end;
     LzmaEnc_Destroy(enc_hand, &g_Alloc, &g_Alloc);
-    return 1;
+    return SZ_OK;
 
  end:
     log_msg_custom_errno("Error occurred compressing data: LZMA errno", rt);
@@ -355,18 +368,38 @@ int compress_data_incr(FILE *input, FILE *output, const CLzmaEncProps *args)
     return rt;
 }
 
-int decompress_data_incr(FILE *input, FILE *output)
+int compress_data_incr(FILE *input, FILE *output, const CLzmaEncProps *args)
+{
+    /* iseqinstream and iseqoutstream objects */
+    seq_in_stream i_stream = {{read_data}, input};
+    int rt = encode_stream(&i_stream.in_stream, output,
+                           get_file_size_c(input), args);
+    return rt == SZ_OK ? 1 : rt;
+}
+
+int compress_stream(ISeqInStream *in, FILE *output, const CLzmaEncProps *args)
+{
+    return encode_stream(in, output, LZMA_SIZE_UNKNOWN, args) == SZ_OK;
+}
+
+/** @brief Decode the data following the header read by get_header
+ *
+ * @return
+ * 1 - success\n
+ * 0 - failure
+ */
+static int decode_stream(FILE *input, //!< Fp to compressed file, after the header
+                         ISeqOutStream *output, //!< Destination of the data
+                         unsigned long file_size, //!< Size from the header
+                         const unsigned char *props_header //!< Prop from the header
+                         )
 {
-    unsigned long file_size = 0; // size of file
     int rt; // return val
-    unsigned char props_header[LZMA_PROPS_SIZE_FILESIZE];
     CLzmaDec state; // view in LzmaDec.h
 
-    file_size = get_header(input, props_header, LZMA_PROPS_SIZE_FILESIZE);
-    if (file_size == 0) {
-        log_msg("Failed to get file size");
-        return 0; // failed
-    }
+    /* compress_stream output, decode up to the end marker */
+    bool unknown = file_size == LZMA_SIZE_UNKNOWN;
+    bool eof = 0, ok = 1;
     LzmaDec_Construct(&state);
     rt = LzmaDec_Allocate(&state, props_header, LZMA_PROPS_SIZE, &g_Alloc);
     if (rt != SZ_OK) {
@@ -381,39 +414,104 @@ int decompress_data_incr(FILE *input, FILE *output)
     ELzmaStatus status;
     LzmaDec_Init(&state);
     while(1) {
-        if (in_pos == in_read_size) {
+        if (in_pos == in_read_size && !eof) {
             in_read_size = my_read_data(input, in_buff, buffer_cread_size);
             in_pos = 0;
-        } else {
-            in_processed = (SizeT)(in_read_size - in_pos);
-            out_processed = (SizeT)(buffer_cread_size - out_pos);
-            if (out_processed > file_size) {
-                out_processed = (unsigned int)file_size;
-                fin_mode = LZMA_FINISH_END;
-            }
-            rt = LzmaDec_DecodeToBuf(&state,
-                                     out_buff + out_pos,
-                                     &out_processed,
-                                     in_buff + in_pos,
-                                     &in_processed,
-                                     fin_mode,
-                                     &status);
-            in_pos += in_processed;
-            out_pos += out_processed;
+            eof = in_read_size == 0;
+        }
+        in_processed = (SizeT)(in_read_size - in_pos);
+        out_processed = (SizeT)(buffer_cread_size - out_pos);
+        if (!unknown && out_processed > file_size) {
+            out_processed = (unsigned int)file_size;
+            fin_mode = LZMA_FINISH_END;
+        }
+        rt = LzmaDec_DecodeToBuf(&state,
+                                 out_buff + out_pos,
+                                 &out_processed,
+                                 in_buff + in_pos,
+                                 &in_processed,
+                                 fin_mode,
+                                 &status);
+        in_pos += in_processed;
+        out_pos += out_processed;
+        if (!unknown)
             file_size -= out_processed;
 
-            my_write_data(output, out_buff, out_pos);
-            out_pos = 0;
+        if (out_pos && output->Write(output, out_buff, out_pos) != out_pos) {
+            log_msg_custom("Failed to write decompressed data");
+            ok = 0;
+            break;
+        }
+        out_pos = 0;
 
-            if ((rt != SZ_OK) || (file_size == 0))
-                break;
-            if ((in_processed == 0) && (out_processed == 0)) {
-                log_msg_custom("ERROR OCCURRED DECOMPRESS\n");
-                break;
-            }
+        if (rt != SZ_OK) {
+            ok = 0;
+            break;
+        }
+        if (status == LZMA_STATUS_FINISHED_WITH_MARK
+            || (!unknown && file_size == 0))
+            break;
+        if ((in_processed == 0) && (out_processed == 0)
+            && (eof || in_pos < in_read_size)) {
+            log_msg_custom("ERROR OCCURRED DECOMPRESS\n");
+            ok = 0;
+            break;
         }
     }
     LzmaDec_Free(&state, &g_Alloc);
+    return ok;
+}
+
+int decompress_data_incr(FILE *input, FILE *output)
+{
+    seq_out_stream o_stream = {{write_data}, output};
+    return decompress_to_stream(input, &o_stream.out_stream);
+}
+
+int decompress_to_stream(FILE *input, ISeqOutStream *output)
+{
+    unsigned char props_header[LZMA_PROPS_SIZE_FILESIZE];
+
+    unsigned long file_size = get_header(input, props_header,
+                                         LZMA_PROPS_SIZE_FILESIZE);
+    if (file_size == 0) {
+        log_msg("Failed to get file size");
+        return 0; // failed
+    }
+    return decode_stream(input, output, file_size, props_header);
+}
+
+int compress_buf(unsigned char *dest, size_t *dest_len,
+                 const unsigned char *src, size_t src_len,
+                 unsigned char *props, const CLzmaEncProps *args)
+{
+    CLzmaEncProps prop_info;
+    SizeT props_size = LZMA_PROPS_SIZE, out_len = *dest_len;
+    LzmaEncProps_Init(&prop_info);
+    assign_prop_vals(&prop_info, args);
+    prop_info.writeEndMark = 0; // the frame size is kept by the caller
+
+    int rt = LzmaEncode(dest, &out_len, src, src_len, &prop_info, props,
+                        &props_size, 0, NULL, &g_Alloc, &g_Alloc);
+    if (rt != SZ_OK) {
+        log_msg_custom_errno("Error occurred compressing data: LZMA errno", rt);
+        return 0;
+    }
+    *dest_len = out_len;
+    return 1;
+}
+
+int decompress_buf(unsigned char *dest, size_t dest_len,
+                   const unsigned char *src, size_t src_len,
+                   const unsigned char *props)
+{
+    SizeT out_len = dest_len, in_len = src_len;
+    ELzmaStatus status;
+    int rt = LzmaDecode(dest, &out_len, src, &in_len, props, LZMA_PROPS_SIZE,
+                        LZMA_FINISH_END, &status, &g_Alloc);
+    if (rt != SZ_OK || out_len != dest_len) {
+        log_msg_custom_errno("Failed call to LzmaDecode", rt);
+        return 0;
+    }
     return 1;
-    
 }
@@ -4,12 +4,28 @@
 #include "ssl_fn.h"
 #include "log.h"
 #include "lzma_wrapper.h"
+#include "strtab.h"
+#include "infohash.h"
+#include "query.h"
+#include "blockbuilder.h"
+#include "memstat.h"
+#include "chainbin.h"
+#include "chainview.h"
+#include "chainframe.h"
+#include "checkpoint.h"
+#include "crc32c.h"
+#include "textparse.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "time_fn.h"
 
 #include <sstream>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define N_THREADS 5
 #define N_TEST_BLOCKS 9000
@@ -38,45 +54,235 @@ void log_test()
     log_msg("fewf %s\n", "wfean");
 }
 
+/* Test if infohash.c parses and prints every kind of xt back the same
+ *
+ */
+void xt_test()
+{
+    const char *xts[] = {
+        "urn:btih:c12fe1c06bba254a9dc9f519b335aa7c1367a88a",
+        "urn:btih:YEX6BQDLXISUVHOJ6UM3GNNKPQJWPKEK",
+        "urn:sha1:YNCKHTQCWBTRNJIV4WNAE52SJUQCZO5C",
+        "urn:btih:c12fe1c06bba254a9dc9f519b335aa7c1367a88",
+    };
+    char buf[XT_BTIH_MAX];
+    const char *out;
+    pack pk;
+
+    for (int i = 0; i < 4; i++) {
+        pk.xtType = xtParse(xts[i], strlen(xts[i]), &pk.xt.hash);
+        if (pk.xtType == XT_STR)
+            pk.xt.str = (char *)xts[i];
+        xtFormat(&pk, buf, &out);
+        printf("%d %s %s\n", pk.xtType, out,
+               strcmp(out, xts[i]) ? "MISMATCH" : "ok");
+    }
+}
+
 void zip_test()
 {
     compress_file("t2","t2.my7z", NULL);
 }
 
+/* A few public trackers, real magnet data only has a handful of these
+ *
+ */
+const char *test_trackers[] = {
+    "udp://tracker.opentrackr.org:1337/announce",
+    "udp://open.stealth.si:80/announce",
+    "udp://tracker.torrent.eu.org:451/announce",
+    "udp://exodus.desync.com:6969/announce",
+    "udp://tracker.openbittorrent.com:6969/announce",
+    "udp://open.demonii.com:1337/announce",
+    "udp://tracker.moeking.me:6969/announce",
+    "udp://explodie.org:6969/announce",
+    "http://tracker.openbittorrent.com:80/announce",
+    "udp://tracker.tiny-vps.com:6969/announce",
+    "udp://tracker.dler.org:6969/announce",
+    "udp://p4p.arenabg.com:1337/announce",
+};
+#define N_TEST_TRACKERS (sizeof(test_trackers) / sizeof(test_trackers[0]))
+
+/* xorshift32, rand() is shared between threads and rand_r is not on
+ * windows
+ */
+static uint32_t rand_next(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+/* Make block number n with random packs, tr holds the tracker ids
+ *
+ */
+block *block_gen(uint32_t n, uint32_t *seed, const uint32_t *tr)
+{
+    uint16_t j, k, len, nPack;
+    const char charset[] = "qazwsxedcrfvtgbyhnujmikolpQAZWSXEDCRFVTGBYHNUJMIKOLP0123456789";//62
+    const char hex[] = "0123456789abcdef";
+    char dn[121];
+    char xt[XT_BTIH_MAX] = XT_BTIH_PREFIX;
+
+    nPack  = rand_next(seed) % 50 + 50;
+    // names average 75 chars
+    BlockBuilder bb(n, 0, nPack, nPack * 78);
+    if (!bb.ok())
+        return NULL;
+
+    for (j = 0; j < nPack; j++) {
+        k = rand_next(seed) % 90 + 30;
+        len = k;
+        dn[k] = 0;
+        for (k--; k > 0; k--) {
+            dn[k] = charset[rand_next(seed)%62];
+        }
+        dn[0] = '0';
+        for (k = XT_BTIH_PREFIX_LEN; k < XT_BTIH_MAX - 1; k++) {
+            xt[k] = hex[rand_next(seed) % 16];
+        }
+
+        bb.add(std::string_view(dn, len),
+               (uint64_t)(rand_next(seed)%50+1)*1024*1024,
+               std::string_view(xt, XT_BTIH_MAX - 1),
+               tr[rand_next(seed) % N_TEST_TRACKERS]);
+    }
+
+    bb.setKey((uint64_t)(rand_next(seed) % MAX_U16) * MAX_U32);
+    return bb.finish();
+}
+
+/* Intern the test trackers in the chain, tr gets their ids
+ *
+ */
+void tracker_gen(chain *ch, uint32_t *tr)
+{
+    for (uint32_t i = 0; i < N_TEST_TRACKERS; i++) {
+        tr[i] = strtabIntern(&ch->trackers, test_trackers[i],
+                             strlen(test_trackers[i]));
+    }
+}
+
 chain *chain_gen(uint64_t size)
 {
-//#define rand() (33)
     uint64_t i;
-    uint16_t j, k, nPack;
-    const char charset[] = "qazwsxedcrfvtgbyhnujmikolpQAZWSXEDCRFVTGBYHNUJMIKOLP0123456789";//62
-    
-    uint64_t key;
+    uint32_t seed = 2463534242U;
     chain *ch = newChain();
-    char *dn = (char *)malloc(sizeof(char) * 121);
-    
+    uint32_t tr[N_TEST_TRACKERS];
+
+    tracker_gen(ch, tr);
     for (i = 0; i < size && i < MAX_U32; i++) {
-        nPack  = rand() % 50 + 50;
-        pack **packs = (pack **)malloc(sizeof(pack *) * nPack);
-        
-        for (j = 0; j < nPack; j++) {
-            k = rand() % 90 + 30;
-            dn[k] = 0;
-            for (k--; k > 0; k--) {
-                dn[k] = charset[rand()%62];
-            }
-            dn[0] = '0';
-            
-            packs[j] = newPack(dn, (rand()%50+1)*1024*1024, dn, dn);
-        }
-        
-        key = rand() % MAX_U16 * MAX_U32;
-        if (!insertBlock(newBlock((uint32_t)i, key, nPack, packs), ch))
+        block *bx = block_gen((uint32_t)i, &seed, tr);
+        if (bx == NULL || !insertBlock(bx, ch))
             break;
     }
-    free(dn);
     return ch;
 }
 
+typedef struct
+{
+    chain *ch;
+    uint32_t seed;
+    uint32_t count; // # of blocks to append
+    uint32_t bad; // # of blocks a reader found out of place
+    bool stop;
+}appendParams;
+
+void *append_wrap(void *args)
+{
+    appendParams *ap = (appendParams *)args;
+    uint32_t tr[N_TEST_TRACKERS];
+
+    // every producer interns the same urls, the ids must agree
+    tracker_gen(ap->ch, tr);
+    for (uint32_t i = 0; i < ap->count; i++) {
+        uint32_t n = chainReserve(ap->ch, 1);
+        if (n == MAX_U32)
+            break;
+        block *bx = block_gen(n, &ap->seed, tr);
+        if (bx == NULL || !chainPublish(ap->ch, n, bx))
+            chainAbandon(ap->ch, n);
+    }
+    return NULL;
+}
+
+/* Walk the visible prefix while the producers append
+ *
+ */
+void *append_reader(void *args)
+{
+    appendParams *ap = (appendParams *)args;
+    uint32_t seen = 0;
+
+    while (!__atomic_load_n(&ap->stop, __ATOMIC_ACQUIRE)
+           || seen < chainSize(ap->ch)) {
+        uint32_t size = chainSize(ap->ch);
+        for (; seen < size; seen++) {
+            block *bx = chainBlock(ap->ch, seen);
+            ap->bad += bx == NULL || bx->n != seen;
+        }
+    }
+    return NULL;
+}
+
+/* Append N_TEST_BLOCKS from N_THREADS producers with a reader running
+ *
+ */
+void append_test()
+{
+    pthread_t threads[N_THREADS], reader;
+    appendParams ap[N_THREADS], rp;
+    uint32_t tmp, i, bad = 0;
+    chain *ch;
+
+    printf("\nAppending\n");
+    tmp = msNow();
+    ch = chain_gen(N_TEST_BLOCKS);
+    printf("1 thread:  %u blocks, took %u ms\n", chainSize(ch), msNow() - tmp);
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+
+    ch = newChain();
+    rp.ch = ch;
+    rp.bad = 0;
+    rp.stop = 0;
+    tmp = msNow();
+    pthread_create(&reader, NULL, &append_reader, (void *)&rp);
+    for (i = 0; i < N_THREADS; i++) {
+        ap[i].ch = ch;
+        ap[i].seed = 2463534242U + i * 7919;
+        ap[i].count = N_TEST_BLOCKS / N_THREADS
+            + (i < N_TEST_BLOCKS % N_THREADS);
+        pthread_create(&threads[i], NULL, &append_wrap, (void *)&ap[i]);
+    }
+    for (i = 0; i < N_THREADS; i++) pthread_join(threads[i], NULL);
+    __atomic_store_n(&rp.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, NULL);
+    printf("%d threads: %u blocks, took %u ms\n", N_THREADS, chainSize(ch),
+           msNow() - tmp);
+
+    // a number given up must not hide the one reserved after it
+    uint32_t n = chainReserve(ch, 2), seed = 1;
+    uint32_t tr[N_TEST_TRACKERS];
+    tracker_gen(ch, tr);
+    if (n != MAX_U32) {
+        if (!chainPublish(ch, n, NULL))
+            chainAbandon(ch, n);
+        chainPublish(ch, n + 1, block_gen(n + 1, &seed, tr));
+        printf("abandoned %s\n", chainSize(ch) == n + 2
+               && chainBlock(ch, n)->nPack == 0 ? "ok" : "MISMATCH");
+    }
+
+    for (i = 0; i < chainSize(ch); i++)
+        bad += chainBlock(ch, i)->n != i;
+    printf("trackers %u, misplaced %u, reader saw %u misplaced\n",
+           ch->trackers.n, bad, rp.bad);
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
 typedef struct
 {
     char in7z[64];
@@ -92,41 +298,1086 @@ void *decompress_wrap(void *args)
 
 void uncompress_test()
 {
-    pthread_t threads[N_THREADS];
     decompParams dp[N_THREADS];
+    poolGroup g;
 
+    poolGroupInit(&g);
     for (int i = 0; i < N_THREADS; i++) {
         sprintf(dp[i].in7z,"temp%d.file.7z", i+1);
         sprintf(dp[i].outf, "temp%d.1unc",i+1);
-        pthread_create(&threads[i], NULL, &decompress_wrap, (void *)&dp[i]);
+        poolSubmit(&g, &decompress_wrap, (void *)&dp[i]);
+    }
+    poolWait(&g);
+}
+
+#define POOL_TASKS 20000 // tiny tasks of pool_test
+
+static void *pool_count(void *args)
+{
+    __atomic_add_fetch((uint32_t *)args, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+/* Waits for two tasks of its own from inside a task */
+static void *pool_nest(void *args)
+{
+    poolGroup g;
+    poolGroupInit(&g);
+    poolSubmit(&g, pool_count, args);
+    poolSubmit(&g, pool_count, args);
+    poolWait(&g);
+    return pool_count(args);
+}
+
+/* Tiny tasks through the pool against a thread per task, and tasks that
+ * wait for tasks of their own
+ */
+void pool_test()
+{
+    printf("\nThread pool, %u workers\n", poolThreads());
+    uint32_t count = 0, tmp = msNow();
+    poolGroup g;
+    poolGroupInit(&g);
+    for (uint32_t i = 0; i < POOL_TASKS; i++)
+        poolSubmit(&g, pool_count, &count);
+    poolWait(&g);
+    printf("%u tasks: %u ms, %u run %s\n", POOL_TASKS, msNow() - tmp, count,
+           count == POOL_TASKS ? "ok" : "MISMATCH");
+
+    tmp = msNow();
+    for (uint32_t i = 0; i < POOL_TASKS / 10; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, pool_count, &count) == 0)
+            pthread_join(tid, NULL);
+    }
+    printf("%u threads: %u ms\n", POOL_TASKS / 10, msNow() - tmp);
+
+    count = 0;
+    for (uint32_t i = 0; i < N_THREADS * 4; i++)
+        poolSubmit(&g, pool_nest, &count);
+    poolWait(&g);
+    printf("nested tasks: %u run %s\n", count,
+           count == N_THREADS * 4 * 3 ? "ok" : "MISMATCH");
+}
+
+/* Check the columnar queries against the pack* layout and time both
+ *
+ */
+void query_test()
+{
+    chain *ch = chain_gen(N_TEST_BLOCKS);
+    uint64_t total = 0, count = 0, max = 0;
+    uint32_t tmp, blk = 0, i;
+    uint16_t pk = 0, j;
+
+    printf("\nQuerying\n");
+    tmp = msNow();
+    for (i = 0; i < chainSize(ch); i++) {
+        block *bx = chainBlock(ch, i);
+        for (j = 0; j < bx->nPack; j++) {
+            pack *px = bx->packs[j];
+            total += px->xl;
+            count += px->tr == 0;
+            if (px->xl > max)
+                max = px->xl;
+        }
+    }
+    printf("packs:   size %lu, tracker 0 %lu, largest %lu, took %u ms\n",
+           total, count, max, msNow() - tmp);
+
+    chainColumnize(ch);
+    tmp = msNow();
+    total = chainTotalSize(ch);
+    count = chainCountTracker(ch, 0);
+    chainLargest(ch, &blk, &pk);
+    printf("columns: size %lu, tracker 0 %lu, largest %lu, took %u ms\n",
+           total, count, blockPack(chainBlock(ch, blk), pk)->xl,
+           msNow() - tmp);
+
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* partToText as it was before the buffered writer, one snprintf and
+ * fwrite per field group
+ */
+void text_legacy(chain *ch, FILE *fp)
+{
+    int len = 3000;
+    char *buf = (char *)memAlloc(MEM_IO, len + 1);
+    uint32_t i, size = chainSize(ch);
+
+    snprintf(buf, len, "Ctime: %u,\nCsize: %u,\n", 1, size);
+    fwrite(buf, 1, strlen(buf), fp);
+    for (i = 0; i < ch->trackers.n; i++) {
+        snprintf(buf, len, "Cdict: %u %s,\n", i, strtabGet(&ch->trackers, i));
+        fwrite(buf, 1, strlen(buf), fp);
     }
-    for (int i = 0; i < N_THREADS; i++) pthread_join(threads[i], NULL);
+    for (i = 0; i < size; i++)
+        blockToText(chainBlock(ch, i), fp, buf, len);
+    strcpy(buf, "EOF\n");
+    fwrite(buf, 1, strlen(buf), fp);
+    memFree(MEM_IO, buf);
+}
+
+/* Read a whole file into a MEM_IO buffer, *len gets its size */
+char *file_slurp(const char *name, long *len)
+{
+    FILE *fp = fopen(name, "rb");
+    char *data = NULL;
+    if (fp == NULL)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = (char *)memAlloc(MEM_IO, *len + 1);
+    if (data && fread(data, 1, *len, fp) != (size_t)*len) {
+        memFree(MEM_IO, data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+/* Copy a whole file, 0 if it can't be read or written */
+bool file_copy(const char *from, const char *to)
+{
+    long len;
+    char *data = file_slurp(from, &len);
+    FILE *fp = data ? fopen(to, "wb") : NULL;
+    bool ok = fp && fwrite(data, 1, len, fp) == (size_t)len;
+    if (fp)
+        ok &= fclose(fp) == 0;
+    memFree(MEM_IO, data);
+    return ok;
+}
+
+/* Text writer throughput, snprintf per field against the buffered
+ * emitters, and check both print the same bytes
+ */
+void text_test()
+{
+    chain *ch = chain_gen(N_TEST_BLOCKS);
+    const char *names[2] = {"orig1.file", "orig2.file"};
+    uint32_t ms[2];
+    long len[2] = {0, 0};
+    char *data[2];
+
+    printf("\nText writer\n");
+    for (int i = 0; i < 2; i++) {
+        FILE *fp = fopen(names[i], "w");
+        if (fp == NULL) {
+            log_msg_default;
+            deleteChain(ch);
+            memFree(MEM_CHAIN, ch);
+            return;
+        }
+        ms[i] = msNow();
+        if (i == 0)
+            text_legacy(ch, fp);
+        else
+            partToText(ch, 0, chainSize(ch), 1, fp);
+        fclose(fp);
+        ms[i] = msNow() - ms[i];
+    }
+
+    data[0] = file_slurp(names[0], &len[0]);
+    data[1] = file_slurp(names[1], &len[1]);
+    for (int i = 0; i < 2; i++) {
+        printf("%s: %ld bytes, %u ms, %.0f MB/s\n",
+               i ? "buffered" : "snprintf", len[i], ms[i],
+               ms[i] ? len[i] / 1048.576 / ms[i] : 0.0);
+    }
+    printf("output %s\n", data[0] && data[1] && len[0] == len[1]
+           && !memcmp(data[0], data[1], len[0]) ? "identical" : "DIFFERS");
+    memFree(MEM_IO, data[0]);
+    memFree(MEM_IO, data[1]);
+
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* Time saving and loading the whole chain as one text and one binary
+ * part, uncompressed, and check both load back the same
+ */
+void bin_test()
+{
+    chain *ch = chain_gen(N_TEST_BLOCKS), *back;
+    const char *names[2] = {"orig1.file", "orig1.bin"};
+    uint32_t tmp, size = chainSize(ch);
+    FILE *fp;
+
+    printf("\nSaving and loading %u blocks\n", size);
+    for (uint8_t fmt = CHAIN_TEXT; fmt <= CHAIN_BIN; fmt++) {
+        tmp = msNow();
+        fp = fopen(names[fmt], fmt == CHAIN_BIN ? "wb" : "w");
+        if (fp == NULL) {
+            log_msg_default;
+            break;
+        }
+        if (fmt == CHAIN_BIN)
+            partToBin(ch, 0, size, 1, fp);
+        else
+            partToText(ch, 0, size, 1, fp);
+        long bytes = ftell(fp);
+        fclose(fp);
+        printf("%s: save %u ms, %ld bytes", fmt == CHAIN_BIN ? "bin " : "text",
+               msNow() - tmp, bytes);
+
+        tmp = msNow();
+        back = newChain();
+        fp = fopen(names[fmt], fmt == CHAIN_BIN ? "rb" : "r");
+        if (fmt == CHAIN_BIN)
+            binFile2Chain(fp, back);
+        else
+            textFile2Chain(fp, back);
+        fclose(fp);
+        printf(", load %u ms, %u blocks, %s\n", msNow() - tmp,
+               chainSize(back),
+               chainTotalSize(back) == chainTotalSize(ch) ? "ok" : "MISMATCH");
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+    }
+
+    // header only scans, jumping over the bodies
+    long len;
+    char *data = file_slurp(names[CHAIN_BIN], &len);
+    if (data != NULL) {
+        const int rounds = 1000;
+        binCursor c = {(const uint8_t *)data, (const uint8_t *)data + len};
+        binPart ph;
+        std::string_view url;
+        uint64_t body = 0, blocks = 0;
+        bool ok = binPartHeader(&c, &ph);
+        for (uint32_t i = 0; ok && i < ph.nDict; i++)
+            ok = binDictEntry(&c, &url);
+        const uint8_t *first = c.p;
+        tmp = msNow();
+        for (int r = 0; ok && r < rounds; r++) {
+            binBlock h;
+            binBlockStart(&h);
+            c.p = first;
+            for (uint32_t i = 0; ok && i < ph.nBlock; i++) {
+                ok = binBlockSkip(&c, &h);
+                body += h.body;
+            }
+            blocks += ph.nBlock;
+        }
+        uint32_t ms = msNow() - tmp;
+        printf("header scan: %lu headers, %u ms, %.1f M headers/s, "
+               "%.1f bytes per header, %s\n", blocks, ms,
+               ms ? blocks / 1000.0 / ms : 0.0,
+               ((double)(c.p - first) * rounds - body) / blocks,
+               ok && blocks == (uint64_t)size * rounds ? "ok" : "MISMATCH");
+        memFree(MEM_IO, data);
+    }
+
+    // same part through a mapping, nothing is built
+    memStat before, after;
+    memGet(MEM_CHAIN, &before);
+    tmp = msNow();
+    chainView *cv = chainViewOpen(names[CHAIN_BIN]);
+    if (cv != NULL) {
+        uint32_t open = msNow() - tmp;
+        uint64_t total = 0;
+        memGet(MEM_CHAIN, &after);
+        for (uint32_t i = 0; i < chainViewSize(cv); i++) {
+            binBlock h;
+            binCursor c;
+            binPack pk;
+            chainViewBlock(cv, i, &h, &c);
+            for (uint16_t j = 0; j < h.nPack; j++) {
+                binPackGet(&c, &pk);
+                total += pk.xl;
+            }
+        }
+        printf("view: open %u ms, scan %u ms, %u blocks, %lu bytes held, %s\n",
+               open, msNow() - tmp - open, chainViewSize(cv),
+               after.live - before.live,
+               total == chainTotalSize(ch) ? "ok" : "MISMATCH");
+
+        // a bad body is found when its block is read, not when opening
+        long rawLen;
+        char *raw = file_slurp(names[CHAIN_BIN], &rawLen);
+        uint8_t *at = raw ? (uint8_t *)raw + cv->block[0] : NULL;
+        FILE *bad = at ? fopen("bad1.bin", "wb") : NULL;
+        if (bad != NULL) {
+            at[2 + (at[0] | at[1] << 8) + 8 + 4] = 0x7f; // xtType
+            fwrite(raw, 1, rawLen, bad);
+            fclose(bad);
+        }
+        memFree(MEM_IO, raw);
+        chainView *bv = chainViewOpen("bad1.bin");
+        binBlock h;
+        binCursor c;
+        printf("view, bad body: %s\n", bv && !chainViewBlock(bv, 0, &h, &c)
+               && chainViewBlock(bv, 1, &h, &c)
+               ? "caught on read" : "MISMATCH");
+        // and stops an append before its unmapped tracker ids get in
+        chain *lazy = newChain(), *dst = newChain();
+        bool moved = bv && chainViewLoad(bv, lazy) && chainAppend(dst, lazy);
+        printf("append, bad body: %s\n", !moved
+               && chainSize(lazy) == chainViewSize(cv)
+               && chainSize(dst) == chainViewSize(cv)
+               && chainBlock(dst, 0)->nPack == 0 ? "stopped" : "MISMATCH");
+        deleteChain(lazy);
+        memFree(MEM_CHAIN, lazy);
+        deleteChain(dst);
+        memFree(MEM_CHAIN, dst);
+        chainViewClose(bv);
+        chainViewClose(cv);
+    }
+
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* 1 if two blocks hold the same packs */
+bool block_eq(block *a, block *b)
+{
+    if (a->n != b->n || a->nPack != b->nPack || a->key != b->key)
+        return 0;
+    for (uint16_t i = 0; i < a->nPack; i++) {
+        pack *x = blockPack(a, i), *y = blockPack(b, i);
+        if (x->xl != y->xl || x->tr != y->tr || strcmp(x->dn, y->dn)
+            || x->xtType != y->xtType
+            || (x->xtType != XT_STR && !infohashEq(&x->xt.hash, &y->xt.hash))
+            || (x->xtType == XT_STR && strcmp(x->xt.str, y->xt.str)))
+            return 0;
+    }
+    return 1;
+}
+
+/* Names and topics past 255 bytes through newBlock and a binary part,
+ * and a pack over PACK_STR_MAX failing its block instead of vanishing
+ */
+void long_test()
+{
+    chain *ch = newChain(), *back = newChain();
+    uint32_t tr = strtabIntern(&ch->trackers, test_trackers[0],
+                               strlen(test_trackers[0]));
+    std::string dn(1000, 'd'), xt = "urn:sha1:" + std::string(600, 'x');
+    char btih[] = "urn:btih:c12fe1c06bba254a9dc9f519b335aa7c1367a88a";
+    bool ok;
+
+    printf("\nLong pack strings\n");
+    dn += "end";
+    pack **packs = (pack **)memAlloc(MEM_PARSER, sizeof(pack *) * 2);
+    packs[0] = newPack((char *)dn.c_str(), 1, (char *)xt.c_str(), tr);
+    packs[1] = newPack((char *)"short", 2, btih, tr);
+    block *bx = newBlock(0, 42, 2, packs);
+    ok = bx && blockPack(bx, 0) && strlen(blockPack(bx, 0)->dn) == dn.size()
+        && insertBlock(bx, ch);
+
+    FILE *fp = fopen("long1.bin", "wb");
+    ok = ok && fp && partToBin(ch, 0, 1, 1, fp);
+    if (fp)
+        fclose(fp);
+    fp = fopen("long1.bin", "rb");
+    ok = ok && fp && binFile2Chain(fp, back) && chainSize(back) == 1
+        && block_eq(chainBlock(back, 0), chainBlock(ch, 0));
+    if (fp)
+        fclose(fp);
+    printf("1003 byte name, 609 byte topic: %s\n", ok ? "ok" : "MISMATCH");
+
+    // past PACK_STR_MAX the block fails as a whole
+    std::string huge(PACK_STR_MAX + 1, 'h');
+    packs = (pack **)memAlloc(MEM_PARSER, sizeof(pack *) * 2);
+    packs[0] = newPack((char *)"short", 1, btih, tr);
+    packs[1] = newPack((char *)"other", 2, btih, tr);
+    memFree(MEM_BLOCK, packs[1]->dn);
+    packs[1]->dn = (char *)memAlloc(MEM_BLOCK, huge.size() + 1);
+    memcpy(packs[1]->dn, huge.c_str(), huge.size() + 1);
+    bx = newBlock(1, 42, 2, packs);
+    printf("name over PACK_STR_MAX: %s\n", bx == NULL ? "block refused"
+           : "MISMATCH pack dropped");
+    if (bx)
+        deleteBlock(bx);
+
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+    deleteChain(back);
+    memFree(MEM_CHAIN, back);
+}
+
+/* Framed part: one block read against decoding every frame, serial and
+ * in parallel
+ */
+void frame_test()
+{
+    chain *ch = chain_gen(N_TEST_BLOCKS), *back;
+    uint32_t tmp, size = chainSize(ch), want = size * 17 / 18;
+    FILE *fp = fopen("orig1.tcf", "wb");
+
+    printf("\nFramed part\n");
+    if (fp == NULL) {
+        log_msg_default;
+        deleteChain(ch);
+        memFree(MEM_CHAIN, ch);
+        return;
+    }
+    tmp = msNow();
+    partToFrames(ch, 0, size, 1, fp);
+    printf("write: %u ms, %ld bytes\n", msNow() - tmp, ftell(fp));
+    fclose(fp);
+
+    for (uint8_t threads = 1; threads <= N_THREADS; threads += N_THREADS - 1) {
+        back = newChain();
+        tmp = msNow();
+        frameFile *ff = frameOpen("orig1.tcf", back);
+        if (ff == NULL)
+            break;
+        if (threads == 1) {
+            block *bx = frameReadBlock(ff, want);
+            printf("block %u: %u ms, %s\n", want, msNow() - tmp,
+                   bx && block_eq(bx, chainBlock(ch, want)) ? "ok" : "MISMATCH");
+            if (bx)
+                deleteBlock(bx);
+            tmp = msNow();
+        }
+        uint32_t nFrame = ff->nFrame - 1;
+        frameLoad(ff, back, threads);
+        frameClose(ff);
+        printf("all %u frames, %u threads: %u ms, %u blocks, %s\n",
+               nFrame, threads, msNow() - tmp, chainSize(back),
+               chainSize(back) == size && block_eq(chainBlock(back, want),
+                                                   chainBlock(ch, want))
+               ? "ok" : "MISMATCH");
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+    }
+
+    // a frame that fails to decode must leave no hole in the chain
+    back = newChain();
+    frameFile *ff = frameOpen("orig1.tcf", back);
+    if (ff != NULL) {
+        ff->idx[ff->nFrame / 2].packed /= 2; // truncated frame
+        bool ok = frameLoad(ff, back, N_THREADS);
+        frameClose(ff);
+        uint32_t n = chainReserve(back, 1);
+        chainAbandon(back, n);
+        printf("bad frame: %s\n", !ok && n == 0 && chainSize(back) == 1
+               ? "rejected" : "MISMATCH");
+    }
+    // a header whose first block the index does not start at
+    long len;
+    char *data = file_slurp("orig1.tcf", &len);
+    fp = data && len > 16 ? fopen("bad1.tcf", "wb") : NULL;
+    if (fp != NULL) {
+        data[12] += 5; // header first, the index starts below it
+        fwrite(data, 1, len, fp);
+        fclose(fp);
+    }
+    memFree(MEM_IO, data);
+    ff = frameOpen("bad1.tcf", back);
+    printf("bad frame, header first: %s\n", ff == NULL ? "rejected"
+           : "MISMATCH");
+    frameClose(ff);
+    deleteChain(back);
+    memFree(MEM_CHAIN, back);
+
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* Text loaders: fgets line by line against the buffer parser, both
+ * must rebuild the blocks exactly (crc) */
+void parse_test()
+{
+    const char *name = "orig1.file";
+    chain *ch = chain_gen(N_TEST_BLOCKS);
+    uint32_t size = chainSize(ch);
+    FILE *fp = fopen(name, "w");
+
+    printf("\nParsing text\n");
+    if (fp == NULL) {
+        log_msg_default;
+        deleteChain(ch);
+        memFree(MEM_CHAIN, ch);
+        return;
+    }
+    partToText(ch, 0, size, 1, fp);
+    long bytes = ftell(fp);
+    fclose(fp);
+
+    // fgets, then the buffer parser on 1 and N_THREADS threads
+    for (int run = 0; run < 3; run++) {
+        const char *what[3] = {"fgets    ", "buffer x1", "buffer x5"};
+        chain *back = newChain();
+        uint32_t tmp = msNow();
+        fp = fopen(name, "r");
+        if (run == 0)
+            text2Chainz(fp, back);
+        else
+            textFile2Chain(fp, back, run == 1 ? 1 : N_THREADS);
+        fclose(fp);
+        uint32_t ms = msNow() - tmp;
+        bool same = chainSize(back) == size;
+        for (uint32_t i = 0; same && i < size; i += 997)
+            same = block_eq(chainBlock(back, i), chainBlock(ch, i));
+        same = same && block_eq(chainBlock(back, size - 1),
+                                chainBlock(ch, size - 1));
+        printf("%s: %u ms, %.0f MB/s, %u blocks, %s\n", what[run], ms,
+               ms ? bytes / 1048.576 / ms : 0.0, chainSize(back),
+               same && !chainVerify(back, 0, size, N_THREADS)
+               ? "ok" : "MISMATCH");
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+    }
+
+    // structural scan alone, over the whole part a window at a time
+    long len;
+    char *data = file_slurp(name, &len);
+    if (data != NULL) {
+        uint16_t *idx = (uint16_t *)memAlloc(MEM_IO, sizeof(uint16_t) * TEXT_WINDOW);
+        uint64_t lines[2] = {0, 0};
+        uint32_t ms[2];
+        for (int scalar = 0; idx && scalar < 2; scalar++) {
+            uint32_t tmp = msNow();
+            for (long off = 0; off < len; off += TEXT_WINDOW) {
+                uint32_t w = len - off < TEXT_WINDOW ? len - off : TEXT_WINDOW;
+                lines[scalar] += scalar ? textScanLinesScalar(data + off, w, idx)
+                    : textScanLines(data + off, w, idx);
+            }
+            ms[scalar] = msNow() - tmp;
+        }
+        if (idx)
+            printf("scan (%s): %u ms, %.1f GB/s, scalar %u ms, %lu lines, %s\n",
+                   textScanName(), ms[0], ms[0] ? len / 1e6 / ms[0] : 0.0,
+                   ms[1], lines[0], lines[0] == lines[1] ? "ok" : "MISMATCH");
+        memFree(MEM_IO, idx);
+        memFree(MEM_IO, data);
+    }
+
+    // sizes past 2^53 went through atof before
+    outBuf ob;
+    chain *back = newChain();
+    BlockBuilder bb(0, 0, 1);
+    const uint64_t big = ~0ULL - 1;
+    bb.add("big", big, XT_BTIH_PREFIX "0123456789abcdef0123456789abcdef01234567",
+           STRTAB_NONE);
+    block *bx = bb.finish();
+    if (outBufInit(&ob, NULL) && bx != NULL) {
+        blockToBuf(bx, &ob);
+        textBuf2Chain(ob.buf, ob.len, back);
+        printf("xl 2^64 - 2: %s\n", chainSize(back) == 1
+               && blockPack(chainBlock(back, 0), 0)->xl == big
+               ? "ok" : "MISMATCH");
+    }
+    outBufFree(&ob);
+    if (bx)
+        deleteBlock(bx);
+    deleteChain(back);
+    memFree(MEM_CHAIN, back);
+
+    // names past the old 255 byte limit, both loaders take them
+    std::string dn(1000, 'n');
+    BlockBuilder lb(0, 0, 1);
+    lb.add(dn + "end", 1, XT_BTIH_PREFIX "0123456789abcdef0123456789abcdef01234567",
+           STRTAB_NONE);
+    bx = lb.finish();
+    fp = fopen("long1.file", "w");
+    if (fp != NULL && bx != NULL && outBufInit(&ob, fp)) {
+        blockToBuf(bx, &ob);
+        outBufFree(&ob);
+    }
+    if (fp)
+        fclose(fp);
+    for (int run = 0; bx && run < 2; run++) {
+        back = newChain();
+        fp = fopen("long1.file", "r");
+        if (fp && run == 0)
+            text2Chainz(fp, back);
+        else if (fp)
+            textFile2Chain(fp, back);
+        if (fp)
+            fclose(fp);
+        printf("%s: 1003 byte name %s\n", run ? "buffer" : "fgets ",
+               chainSize(back) == 1 && block_eq(chainBlock(back, 0), bx)
+               ? "ok" : "MISMATCH");
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+    }
+    if (bx)
+        deleteBlock(bx);
+
+    // more trackers than a u16 id holds, the last one still resolves
+    const uint32_t nTr = 70000;
+    chain *many = newChain();
+    char url[64];
+    for (uint32_t i = 0; i < nTr; i++) {
+        snprintf(url, sizeof(url), "udp://tracker%u.example.org:80", i);
+        strtabIntern(&many->trackers, url, strlen(url));
+    }
+    BlockBuilder mb(0, 0, 2);
+    mb.add("first", 1, XT_BTIH_PREFIX "0123456789abcdef0123456789abcdef01234567",
+           0);
+    mb.add("last", 2, XT_BTIH_PREFIX "0123456789abcdef0123456789abcdef01234567",
+           nTr - 1);
+    insertBlock(mb.finish(), many);
+    fp = fopen("many1.file", "w");
+    if (fp != NULL) {
+        partToText(many, 0, chainSize(many), 1, fp);
+        fclose(fp);
+    }
+    for (int run = 0; chainSize(many) && run < 2; run++) {
+        back = newChain();
+        fp = fopen("many1.file", "r");
+        if (fp && run == 0)
+            text2Chainz(fp, back);
+        else if (fp)
+            textFile2Chain(fp, back);
+        if (fp)
+            fclose(fp);
+        pack *pk = chainSize(back) ? blockPack(chainBlock(back, 0), 1) : NULL;
+        printf("%s: %u trackers %s\n", run ? "buffer" : "fgets ", nTr,
+               pk && pk->tr != STRTAB_NONE
+               && !strcmp(strtabGet(&back->trackers, pk->tr), url)
+               ? "ok" : "MISMATCH");
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+    }
+    deleteChain(many);
+    memFree(MEM_CHAIN, many);
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* 1 if @p back holds the same blocks as @p ch */
+bool chain_same(chain *back, chain *ch)
+{
+    uint32_t size = chainSize(ch);
+    bool same = chainSize(back) == size;
+    for (uint32_t i = 0; same && i < size; i++)
+        same = block_eq(chainBlock(back, i), chainBlock(ch, i));
+    return same && !chainVerify(back, 0, size, N_THREADS);
+}
+
+/* Feed the incremental parsers pieces of every size, then load .7z parts
+ * decoding and parsing at once, against a temporary file and a parse
+ */
+void stream_test()
+{
+    const char *names[2] = {"stream1.file", "stream1.bin"};
+    const uint32_t cuts[5] = {1, 7, 333, 4099, 65536};
+    chain *ch = chain_gen(N_TEST_BLOCKS / 3);
+    uint32_t size = chainSize(ch);
+    char path[64];
+
+    printf("\nStreaming parts\n");
+    for (int bin = 0; bin < 2; bin++) {
+        FILE *fp = fopen(names[bin], "wb");
+        if (fp == NULL) {
+            log_msg_default;
+            continue;
+        }
+        bin ? partToBin(ch, 0, size, 1, fp)
+            : partToText(ch, 0, size, 1, fp);
+        fclose(fp);
+
+        // a piece can end anywhere, in a header, a line or a tag
+        long len;
+        char *data = file_slurp(names[bin], &len);
+        chain *back = newChain();
+        textStream ts;
+        binStream bs;
+        bin ? binStreamInit(&bs) : textStreamInit(&ts);
+        bool ok = data != NULL;
+        for (long off = 0, k = 0; ok && off < len; k++) {
+            uint32_t n = cuts[k % 5] < len - off ? cuts[k % 5] : len - off;
+            ok = bin ? binStreamFeed(&bs, data + off, n, back)
+                : textStreamFeed(&ts, data + off, n, back);
+            off += n;
+        }
+        ok = (bin ? binStreamEnd(&bs) : textStreamEnd(&ts, back)) && ok;
+        printf("%s in pieces: %u blocks, %s\n", bin ? "binary" : "text  ",
+               chainSize(back), ok && chain_same(back, ch) ? "ok" : "MISMATCH");
+        memFree(MEM_IO, data);
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+
+        // the .7z through a temporary file, then streamed
+        snprintf(path, sizeof(path), "%s.7z", names[bin]);
+        fp = fopen(path, "wb");
+        if (fp == NULL) {
+            log_msg_default;
+            continue;
+        }
+        partToLzma(ch, 0, size, 1, bin ? CHAIN_BIN : CHAIN_TEXT, fp);
+        fclose(fp);
+        uint32_t ms[2];
+        for (int run = 0; run < 2; run++) {
+            back = newChain();
+            uint32_t tmp = msNow();
+            if (run == 0) {
+                decompress_file(path, "stream1.1unc");
+                fp = fopen("stream1.1unc", "rb");
+                ok = fp && (bin ? binFile2Chain(fp, back)
+                            : textFile2Chain(fp, back));
+            } else {
+                fp = fopen(path, "rb");
+                ok = fp && lzmaFile2Chain(fp, back,
+                                          bin ? CHAIN_BIN : CHAIN_TEXT);
+            }
+            if (fp)
+                fclose(fp);
+            ms[run] = msNow() - tmp;
+            ok = ok && chain_same(back, ch);
+            deleteChain(back);
+            memFree(MEM_CHAIN, back);
+            if (!ok)
+                break;
+        }
+        printf("%s .7z: via file %u ms, streamed %u ms, %s\n",
+               bin ? "binary" : "text  ", ms[0], ms[1], ok ? "ok" : "MISMATCH");
+    }
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* The same part through rings of different depths: the .7z must not
+ * change, only how long the encoder waits for the serializers
+ */
+void pipe_test()
+{
+    const uint8_t depths[3] = {1, PART_PIPE_DEPTH, 16};
+    chain *ch = chain_gen(N_TEST_BLOCKS / 30);
+    char *first = NULL;
+    long firstLen = 0;
+
+    printf("\nSerialize/encode pipeline, %u blocks\n", chainSize(ch));
+    for (int d = 0; d < 3; d++) {
+        partStat st;
+        char path[64];
+        snprintf(path, sizeof(path), "pipe%u.7z", depths[d]);
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL) {
+            log_msg_default;
+            continue;
+        }
+        uint32_t tmp = msNow();
+        bool ok = partToLzma(ch, 0, chainSize(ch), 1, CHAIN_TEXT, fp,
+                             depths[d], &st);
+        fclose(fp);
+        tmp = msNow() - tmp;
+
+        long len = 0;
+        char *data = file_slurp(path, &len);
+        if (d == 0) {
+            first = data;
+            firstLen = len;
+        }
+        ok = ok && data && len == firstLen && !memcmp(data, first, len);
+        printf("depth %2u: %u ms, %llu bytes in, serialize %llu ms, "
+               "encode %llu ms, waited %llu ms, full %u, %s\n", depths[d], tmp,
+               (unsigned long long)st.raw, (unsigned long long)st.serUs / 1000,
+               (unsigned long long)st.encUs / 1000,
+               (unsigned long long)st.waitUs / 1000, st.full,
+               ok ? "same .7z" : "MISMATCH");
+        if (d)
+            memFree(MEM_IO, data);
+    }
+    memFree(MEM_IO, first);
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* Decode the packs of every block of a chain, recording the arrays */
+typedef struct
+{
+    chain  *ch;
+    pack ***got;
+}lazyArgs;
+
+static void *lazy_touch(void *args)
+{
+    lazyArgs *la = (lazyArgs *)args;
+    for (uint32_t i = 0; i < chainSize(la->ch); i++)
+        la->got[i] = blockPacks(chainBlock(la->ch, i));
+    return NULL;
+}
+
+/* Load a binary part whole and header only, then decode the packs on
+ * first use from several threads at once
+ */
+void lazy_test()
+{
+    const char *name = "lazy1.bin";
+    chain *ch = chain_gen(N_TEST_BLOCKS);
+    uint32_t size = chainSize(ch), tmp;
+    FILE *fp = fopen(name, "wb");
+
+    printf("\nHeader only loading\n");
+    if (fp == NULL) {
+        log_msg_default;
+        deleteChain(ch);
+        memFree(MEM_CHAIN, ch);
+        return;
+    }
+    partToBin(ch, 0, size, 1, fp);
+    fclose(fp);
+
+    chain *full = newChain();
+    tmp = msNow();
+    fp = fopen(name, "rb");
+    bool ok = fp && binFile2Chain(fp, full);
+    if (fp)
+        fclose(fp);
+    printf("whole:  %u ms, %u blocks\n", msNow() - tmp, chainSize(full));
+
+    memStat before, after;
+    memGet(MEM_BLOCK, &before);
+    chain *lazy = newChain();
+    tmp = msNow();
+    chainView *cv = chainViewOpen(name);
+    ok = ok && cv && chainViewLoad(cv, lazy);
+    uint32_t ms = msNow() - tmp;
+    uint64_t packs = 0, keys = 0;
+    for (uint32_t i = 0; ok && i < chainSize(lazy); i++) {
+        packs += chainBlock(lazy, i)->nPack;
+        keys ^= chainBlock(lazy, i)->key;
+    }
+    memGet(MEM_BLOCK, &after);
+    printf("lazy:   %u ms, %u blocks, %lu packs, %lu block bytes held\n", ms,
+           chainSize(lazy), packs, after.live - before.live);
+
+    // every thread decodes on first use, they must all end up on one copy
+    pthread_t tid[N_THREADS];
+    lazyArgs la[N_THREADS];
+    for (int t = 0; ok && t < N_THREADS; t++) {
+        la[t].ch = lazy;
+        la[t].got = (pack ***)memAlloc(MEM_IO, sizeof(pack **) * (size + 1));
+        if (la[t].got == NULL || pthread_create(&tid[t], NULL, lazy_touch, &la[t])) {
+            memFree(MEM_IO, la[t].got);
+            la[t].got = NULL;
+        }
+    }
+    tmp = msNow();
+    for (int t = 0; ok && t < N_THREADS; t++)
+        if (la[t].got)
+            pthread_join(tid[t], NULL);
+    ms = msNow() - tmp;
+    bool same = ok;
+    for (int t = 0; ok && t < N_THREADS; t++) {
+        for (uint32_t i = 0; same && la[t].got && i < size; i++)
+            same = la[t].got[i] == chainBlock(lazy, i)->packs;
+        memFree(MEM_IO, la[t].got);
+    }
+    same = same && chainSize(lazy) == size && chainSize(full) == size;
+    for (uint32_t i = 0; same && i < size; i++)
+        same = block_eq(chainBlock(lazy, i), chainBlock(full, i));
+    printf("decode: %u ms on %d threads, %s\n", ms, N_THREADS,
+           same && !chainVerify(lazy, 0, size, N_THREADS) ? "ok" : "MISMATCH");
+
+    // the blocks point into the mapping, they go before the view
+    deleteChain(lazy);
+    memFree(MEM_CHAIN, lazy);
+    chainViewClose(cv);
+    deleteChain(full);
+    memFree(MEM_CHAIN, full);
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* Checkpoint a chain, grow it by 1/10 and checkpoint again, the second
+ * one should only cost the new blocks
+ */
+void checkpoint_test()
+{
+    const uint32_t grow = N_TEST_BLOCKS / 10;
+    chain *ch = chain_gen(N_TEST_BLOCKS / 3), *back;
+    uint32_t tmp, saved, seed = 88172645U, tr[N_TEST_TRACKERS];
+
+    printf("\nCheckpoint\n");
+    remove("ckpt.mf");
+    tmp = msNow();
+    chainCheckpoint(ch, "ckpt", &saved);
+    printf("first: %u blocks, %u ms\n", saved, msNow() - tmp);
+
+    tracker_gen(ch, tr);
+    for (uint32_t i = 0; i < grow; i++) {
+        block *bx = block_gen(chainSize(ch), &seed, tr);
+        if (bx == NULL || !insertBlock(bx, ch))
+            break;
+    }
+    tmp = msNow();
+    chainCheckpoint(ch, "ckpt", &saved);
+    printf("next:  %u blocks, %u ms\n", saved, msNow() - tmp);
+    chainCheckpoint(ch, "ckpt", &saved);
+    printf("none:  %u blocks\n", saved);
+
+    tmp = msNow();
+    back = chainRestore("ckpt");
+    if (back) {
+        uint32_t size = chainSize(ch), last = size - 1;
+        printf("restore: %u ms, %u blocks, %s\n", msNow() - tmp,
+               chainSize(back), chainSize(back) == size
+               && block_eq(chainBlock(back, last), chainBlock(ch, last))
+               && block_eq(chainBlock(back, 0), chainBlock(ch, 0))
+               ? "ok" : "MISMATCH");
+        deleteChain(back);
+        memFree(MEM_CHAIN, back);
+    }
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* CRC32C: known answer, crc32 instruction against the table, and
+ * checking a whole chain in parallel
+ */
+void crc_test()
+{
+    const size_t len = 64U << 20;
+    uint8_t *buf = (uint8_t *)memAlloc(MEM_IO, len);
+    uint32_t tmp, seed = 2463534242U;
+
+    printf("\nCRC32C (%s)\n", crc32cHw() ? "sse4.2" : "table");
+    printf("known answer: %s\n", crc32c(0, "123456789", 9) == 0xe3069283
+           && crc32cTable(0, "123456789", 9) == 0xe3069283 ? "ok" : "MISMATCH");
+    if (buf != NULL) {
+        for (size_t i = 0; i < len; i++)
+            buf[i] = (uint8_t)rand_next(&seed);
+        tmp = msNow();
+        uint32_t a = crc32c(0, buf, len);
+        uint32_t ms = msNow() - tmp;
+        tmp = msNow();
+        uint32_t b = crc32cTable(crc32cTable(0, buf, len / 3), buf + len / 3,
+                                 len - len / 3);
+        uint32_t msTable = msNow() - tmp;
+        printf("64 MB: %u ms, table %u ms, %s\n", ms, msTable,
+               a == b ? "ok" : "MISMATCH");
+        memFree(MEM_IO, buf);
+    }
+
+    chain *ch = chain_gen(N_TEST_BLOCKS);
+    for (uint8_t threads = 1; threads <= N_THREADS; threads += N_THREADS - 1) {
+        tmp = msNow();
+        uint32_t bad = chainVerify(ch, 0, chainSize(ch), threads);
+        printf("verify %u blocks, %u threads: %u ms, %s\n", chainSize(ch),
+               threads, msNow() - tmp, bad ? "MISMATCH" : "ok");
+    }
+    // one flipped size must be caught
+    pack *pk = blockPack(chainBlock(ch, 1234), 0);
+    pk->xl ^= 1;
+    printf("corrupt block: %s\n",
+           chainVerify(ch, 0, chainSize(ch), N_THREADS) == 1 ? "ok" : "MISMATCH");
+    pk->xl ^= 1;
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
+}
+
+/* Parts of two differently cut chainCompactor runs mixed together, the
+ * extractor must find the gap and the overlap where they meet
+ */
+void cut_test()
+{
+    chain *ch = chain_gen(N_TEST_BLOCKS / 15), *ex;
+    partStat five[N_THREADS], three[3];
+    char from[64], to[64];
+    bool ok;
+
+    printf("\nMixed parts\n");
+    // gap: three's 1st then five's 3rd on, overlap: three's 1st then
+    // five's 2nd on
+    ok = chainCompactor(ch, N_THREADS, CHAIN_BIN, five);
+    for (uint32_t i = 2; i <= N_THREADS; i++) {
+        snprintf(from, sizeof(from), "temp%u.bin.7z", i);
+        snprintf(to, sizeof(to), "over%u.bin.7z", i);
+        ok = ok && file_copy(from, to);
+        snprintf(to, sizeof(to), "gap%u.bin.7z", i - 1);
+        ok = ok && (i == 2 || file_copy(from, to));
+    }
+    ok = chainCompactor(ch, 3, CHAIN_BIN, three) && ok;
+    ok = ok && file_copy("temp1.bin.7z", "over1.bin.7z")
+        && file_copy("temp1.bin.7z", "gap1.bin.7z");
+    // the cuts must fall where the cases need them
+    ok = ok && five[1].start < three[0].end && three[0].end < five[2].start;
+
+    ex = chain_extractor(NULL, 3, CHAIN_BIN);
+    printf("3 parts: %s\n", ok && ex && chainSize(ex) == chainSize(ch)
+           ? "ok" : "MISMATCH");
+    if (ex) {
+        deleteChain(ex);
+        memFree(MEM_CHAIN, ex);
+    }
+    ex = chain_extractor("gap%u.bin.7z", N_THREADS - 1, CHAIN_BIN);
+    printf("gap %s\n", ok && ex == NULL ? "rejected" : "MISMATCH");
+    if (ex) {
+        deleteChain(ex);
+        memFree(MEM_CHAIN, ex);
+    }
+    ex = chain_extractor("over%u.bin.7z", N_THREADS, CHAIN_BIN);
+    printf("overlap %s\n", ok && ex == NULL ? "rejected" : "MISMATCH");
+    if (ex) {
+        deleteChain(ex);
+        memFree(MEM_CHAIN, ex);
+    }
+
+    // a part that can't be created fails the whole call
+    mkdir("temp1.tcf", 0755);
+    printf("unwritable part: %s\n", chainCompactor(ch, 1, CHAIN_FRAME, five)
+           ? "MISMATCH" : "failed");
+    rmdir("temp1.tcf");
+
+    deleteChain(ch);
+    memFree(MEM_CHAIN, ch);
 }
 
 void chain_test()
 {
     printf("\nGenerating\n");
+    uint32_t tmp = msNow();
     chain *ch = chain_gen(N_TEST_BLOCKS);
+    printf("Took %u milliseconds\n", msNow() - tmp);
+    memDump(stdout);
     
     printf("Compressing\n");
-    uint32_t tmp;
-#ifdef _WIN32
-    tmp = GetTickCount();
-    chainCompactor(ch, N_THREADS);
-    tmp = GetTickCount() - tmp;
-#else
-    struct timespec tmp1,tmp2;
-    clock_gettime(CLOCK_MONOTONIC, &tmp1);//Start
-    chainCompactor(ch, N_THREADS);
-    clock_gettime(CLOCK_MONOTONIC, &tmp2);//End
-    tmp = (tmp2.tv_sec - tmp1.tv_sec) * 1000 + (tmp2.tv_nsec - tmp1.tv_nsec) / 1000000;
-#endif
-    printf("Took %d milliseconds\n", tmp);
+    partStat st[N_THREADS];
+    tmp = msNow();
+    bool done = chainCompactor(ch, N_THREADS, CHAIN_TEXT, st);
+    printf("Took %u milliseconds\n", msNow() - tmp);
+    // the parts follow each other and cover the chain
+    uint32_t cover = 0;
+    for (uint32_t i = 0; i < N_THREADS; i++) {
+        printf("  part %u: %u blocks, %lu bytes, %u ms\n", i + 1,
+               st[i].end - st[i].start, st[i].bytes, st[i].ms);
+        cover = st[i].start == cover && st[i].bytes ? st[i].end : MAX_U32;
+    }
+    printf("parts cover %u blocks %s\n", cover,
+           done && cover == chainSize(ch) ? "ok" : "MISMATCH");
     
+    memDump(stdout);
+
+    printf("Extracting\n");
+    tmp = msNow();
+    chain *ex = chain_extractor(NULL, N_THREADS);
+    printf("Took %u milliseconds\n", msNow() - tmp);
+    uint32_t bad = ex == NULL || chainSize(ex) != chainSize(ch);
+    for (uint32_t i = 0; !bad && i < chainSize(ch); i++)
+        bad = chainBlock(ex, i)->n != chainBlock(ch, i)->n
+            || chainBlock(ex, i)->crc != chainBlock(ch, i)->crc;
+    printf("extracted %u blocks %s\n", ex ? chainSize(ex) : 0,
+           bad ? "MISMATCH" : "match");
+    if (ex) {
+        deleteChain(ex);
+        memFree(MEM_CHAIN, ex);
+    }
+    // a pattern naming the parts, one more than there are
+    ex = chain_extractor("temp%u.file.7z", N_THREADS + 1);
+    printf("missing part %s\n", ex ? "MISMATCH loaded" : "rejected");
+    if (ex) {
+        deleteChain(ex);
+        memFree(MEM_CHAIN, ex);
+    }
+
+    tmp = msNow();
     printf("\nFree'd %lu bytes\n", deleteChain(ch) + sizeof(chain));
-    free(ch);
+    memFree(MEM_CHAIN, ch);
+    printf("Took %u milliseconds\n", msNow() - tmp);
     
     uncompress_test();
+    poolStop();
+    memDump(stdout);
 }
 
 //Obsolete
@@ -173,6 +1424,21 @@ int main()
 //    log_test();
 //    chain_test();
 //    zip_test();
+    xt_test();
+    query_test();
+    append_test();
+    text_test();
+    bin_test();
+    long_test();
+    parse_test();
+    stream_test();
+    pipe_test();
+    lazy_test();
+    frame_test();
+    checkpoint_test();
+    crc_test();
+    pool_test();
+    cut_test();
     chain_test();
 //    decompress_test();
 //    sha1_test();
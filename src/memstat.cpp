@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "memstat.h"
+
+static memStat stats[MEM_NSUB + 1]; // last one is the total
+
+/* What an allocation really costs: usable size plus the chunk header */
+static inline size_t memSize(void *ptr)
+{
+#ifdef _WIN32
+    return _msize(ptr) + sizeof(size_t);
+#else
+    return malloc_usable_size(ptr) + sizeof(size_t);
+#endif
+}
+
+/* Raise peak to at least live, lock free */
+static inline void memPeak(memStat *st, uint64_t live)
+{
+    uint64_t peak = __atomic_load_n(&st->peak, __ATOMIC_RELAXED);
+    while (live > peak
+           && !__atomic_compare_exchange_n(&st->peak, &peak, live, 1,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED))
+        ;
+}
+
+static void memCharge(uint8_t sub, size_t size)
+{
+    memStat *st = &stats[sub < MEM_NSUB ? sub : MEM_NSUB - 1];
+    __atomic_add_fetch(&st->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats[MEM_NSUB].allocs, 1, __ATOMIC_RELAXED);
+    memPeak(st, __atomic_add_fetch(&st->live, size, __ATOMIC_RELAXED));
+    memPeak(&stats[MEM_NSUB],
+            __atomic_add_fetch(&stats[MEM_NSUB].live, size, __ATOMIC_RELAXED));
+}
+
+static void memRefund(uint8_t sub, size_t size)
+{
+    memStat *st = &stats[sub < MEM_NSUB ? sub : MEM_NSUB - 1];
+    __atomic_add_fetch(&st->frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats[MEM_NSUB].frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&st->live, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&stats[MEM_NSUB].live, size, __ATOMIC_RELAXED);
+}
+
+void *memAlloc(uint8_t sub, size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr != NULL)
+        memCharge(sub, memSize(ptr));
+    return ptr;
+}
+
+void *memCalloc(uint8_t sub, size_t n, size_t size)
+{
+    void *ptr = calloc(n, size);
+    if (ptr != NULL)
+        memCharge(sub, memSize(ptr));
+    return ptr;
+}
+
+void *memRealloc(uint8_t sub, void *ptr, size_t size)
+{
+    size_t old = ptr ? memSize(ptr) : 0;
+    void *tmp = realloc(ptr, size);
+    if (tmp == NULL)
+        return NULL;
+    // counts as a free of the old block and an allocation of the new one
+    if (ptr != NULL)
+        memRefund(sub, old);
+    memCharge(sub, memSize(tmp));
+    return tmp;
+}
+
+void memFree(uint8_t sub, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    memRefund(sub, memSize(ptr));
+    free(ptr);
+}
+
+void memGet(uint8_t sub, memStat *out)
+{
+    memStat *st = &stats[sub < MEM_NSUB ? sub : MEM_NSUB];
+    out->live = __atomic_load_n(&st->live, __ATOMIC_RELAXED);
+    out->peak = __atomic_load_n(&st->peak, __ATOMIC_RELAXED);
+    out->allocs = __atomic_load_n(&st->allocs, __ATOMIC_RELAXED);
+    out->frees = __atomic_load_n(&st->frees, __ATOMIC_RELAXED);
+}
+
+const char *memName(uint8_t sub)
+{
+    static const char *names[MEM_NSUB + 1] = {
+        "chain", "block", "string", "parser", "io", "lzma", "pool",
+        "total"
+    };
+    return names[sub < MEM_NSUB ? sub : MEM_NSUB];
+}
+
+void memDump(FILE *fp)
+{
+    memStat st;
+    fprintf(fp, "%-8s %14s %14s %12s %12s\n",
+            "memory", "live", "peak", "allocs", "frees");
+    for (uint8_t i = 0; i <= MEM_NSUB; i++) {
+        memGet(i, &st);
+        fprintf(fp, "%-8s %14lu %14lu %12lu %12lu\n", memName(i),
+                st.live, st.peak, st.allocs, st.frees);
+    }
+}
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "outbuf.h"
+#include "memstat.h"
+#include "log.h"
+
+bool outBufInit(outBuf *ob, FILE *fp, uint32_t cap)
+{
+    ob->buf = (char *)memAlloc(MEM_IO, cap);
+    ob->len = 0;
+    ob->cap = ob->buf ? cap : 0;
+    ob->fp = fp;
+    ob->err = ob->buf == NULL;
+    if (ob->err)
+        log_msg_default;
+    return !ob->err;
+}
+
+bool outBufFlush(outBuf *ob)
+{
+    if (ob->fp == NULL)
+        return !ob->err;
+    if (!ob->err && ob->len > 0
+        && fwrite(ob->buf, 1, ob->len, ob->fp) != ob->len) {
+        log_msg_custom("Writing the output buffer failed");
+        ob->err = 1;
+    }
+    ob->len = 0;
+    return !ob->err;
+}
+
+bool outBufFree(outBuf *ob)
+{
+    bool ok = outBufFlush(ob);
+    memFree(MEM_IO, ob->buf);
+    ob->buf = NULL;
+    ob->cap = 0;
+    return ok;
+}
+
+/* Memory only writer, make room for len more bytes */
+static bool outBufGrow(outBuf *ob, uint32_t len)
+{
+    uint32_t cap = ob->cap ? ob->cap : OUTBUF_SIZE;
+    while (cap - ob->len < len)
+        cap *= 2;
+    char *tmp = (char *)memRealloc(MEM_IO, ob->buf, cap);
+    if (tmp == NULL) {
+        log_msg_default;
+        ob->err = 1;
+        return 0;
+    }
+    ob->buf = tmp;
+    ob->cap = cap;
+    return 1;
+}
+
+void outBufSlow(outBuf *ob, const void *data, uint32_t len)
+{
+    if (ob->err)
+        return;
+    if (ob->fp == NULL) {
+        if (outBufGrow(ob, len)) {
+            memcpy(ob->buf + ob->len, data, len);
+            ob->len += len;
+        }
+        return;
+    }
+    if (!outBufFlush(ob))
+        return;
+    if (len < ob->cap) {
+        memcpy(ob->buf, data, len);
+        ob->len = len;
+    } else if (fwrite(data, 1, len, ob->fp) != len) {
+        log_msg_custom("Writing the output buffer failed");
+        ob->err = 1;
+    }
+}
+
+char *outBufRoomSlow(outBuf *ob, uint32_t len)
+{
+    if (ob->err)
+        return NULL;
+    if (ob->fp == NULL ? !outBufGrow(ob, len) : !outBufFlush(ob))
+        return NULL;
+    return ob->cap - ob->len >= len ? ob->buf + ob->len : NULL;
+}
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <thread>
+
+#include "pool.h"
+#include "memstat.h"
+#include "log.h"
+
+#define POOL_DEQUE 64 // first capacity of a deque, a power of two
+
+/* One queued task */
+typedef struct
+{
+    poolFn     fn;
+    void      *arg;
+    poolGroup *g;
+}poolTask;
+
+/* Tasks of one worker, a ring: the owner works at tail, thieves at head */
+typedef struct
+{
+    pthread_mutex_t lock;
+    poolTask *task;
+    uint32_t  head; // oldest task
+    uint32_t  tail; // one past the newest
+    uint32_t  cap;  // power of two
+}poolDeque;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  poolWork = PTHREAD_COND_INITIALIZER; // a task was queued
+static pthread_cond_t  poolDone = PTHREAD_COND_INITIALIZER; // a group emptied
+static poolDeque *poolDq;
+static pthread_t *poolTid;
+static uint32_t   poolN;      // workers, read without the lock once set
+static uint32_t   poolQueued; // tasks in the deques, under poolLock
+static uint32_t   poolNext;   // deque of the next outside submit
+static bool       poolQuit;
+static bool       poolFailed; // no worker could start, run inline
+static thread_local uint32_t poolSelf; // worker index + 1, 0 outside
+
+static void poolRun(poolTask *t)
+{
+    t->fn(t->arg);
+    if (__atomic_sub_fetch(&t->g->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&poolLock);
+        pthread_cond_broadcast(&poolDone);
+        pthread_mutex_unlock(&poolLock);
+    }
+}
+
+/* Pop the newest task of the caller's own deque, or steal the oldest of
+ * another one, starting after the caller's */
+static bool poolTake(poolTask *t)
+{
+    uint32_t n = __atomic_load_n(&poolN, __ATOMIC_ACQUIRE);
+    bool got = 0;
+    if (poolSelf) {
+        poolDeque *d = &poolDq[poolSelf - 1];
+        pthread_mutex_lock(&d->lock);
+        if (d->tail != d->head) {
+            *t = d->task[--d->tail & (d->cap - 1)];
+            got = 1;
+        }
+        pthread_mutex_unlock(&d->lock);
+    }
+    // poolSelf is also the index of the deque after the caller's
+    for (uint32_t k = 0; !got && k < n - (poolSelf ? 1 : 0); k++) {
+        poolDeque *d = &poolDq[(poolSelf + k) % n];
+        pthread_mutex_lock(&d->lock);
+        if (d->tail != d->head) {
+            *t = d->task[d->head++ & (d->cap - 1)];
+            got = 1;
+        }
+        pthread_mutex_unlock(&d->lock);
+    }
+    if (got) {
+        pthread_mutex_lock(&poolLock);
+        poolQueued--;
+        pthread_mutex_unlock(&poolLock);
+    }
+    return got;
+}
+
+static void *poolWorker(void *args)
+{
+    poolSelf = (uint32_t)(uintptr_t)args + 1;
+    for (;;) {
+        poolTask t;
+        if (poolTake(&t)) {
+            poolRun(&t);
+            continue;
+        }
+        pthread_mutex_lock(&poolLock);
+        while (poolQueued == 0 && !poolQuit)
+            pthread_cond_wait(&poolWork, &poolLock);
+        bool quit = poolQuit && poolQueued == 0;
+        pthread_mutex_unlock(&poolLock);
+        if (quit)
+            break;
+    }
+    return NULL;
+}
+
+bool poolStart(uint32_t threads)
+{
+    pthread_mutex_lock(&poolLock);
+    if (poolN || poolFailed) {
+        pthread_mutex_unlock(&poolLock);
+        return poolN != 0;
+    }
+    if (threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads == 0)
+        threads = 1;
+    if (threads > POOL_MAX)
+        threads = POOL_MAX;
+
+    poolDq = (poolDeque *)memAlloc(MEM_POOL, sizeof(poolDeque) * threads);
+    poolTid = (pthread_t *)memAlloc(MEM_POOL, sizeof(pthread_t) * threads);
+    uint32_t i = 0;
+    for (; poolDq && poolTid && i < threads; i++) {
+        poolDeque *d = &poolDq[i];
+        d->task = (poolTask *)memAlloc(MEM_POOL, sizeof(poolTask) * POOL_DEQUE);
+        if (d->task == NULL)
+            break;
+        pthread_mutex_init(&d->lock, NULL);
+        d->head = d->tail = 0;
+        d->cap = POOL_DEQUE;
+    }
+    // workers only look at deques below poolN
+    uint32_t started = 0;
+    while (started < i && !pthread_create(&poolTid[started], NULL, poolWorker,
+                                          (void *)(uintptr_t)started))
+        started++;
+    for (uint32_t j = started; j < i; j++) {
+        pthread_mutex_destroy(&poolDq[j].lock);
+        memFree(MEM_POOL, poolDq[j].task);
+    }
+    if (started == 0) {
+        log_msg_custom("Starting the thread pool failed, running inline");
+        memFree(MEM_POOL, poolDq);
+        memFree(MEM_POOL, poolTid);
+        poolDq = NULL;
+        poolTid = NULL;
+        poolFailed = 1;
+    }
+    __atomic_store_n(&poolN, started, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&poolLock);
+    return started != 0;
+}
+
+void poolStop(void)
+{
+    pthread_mutex_lock(&poolLock);
+    uint32_t n = poolN;
+    poolQuit = 1;
+    pthread_cond_broadcast(&poolWork);
+    pthread_mutex_unlock(&poolLock);
+
+    for (uint32_t i = 0; i < n; i++)
+        pthread_join(poolTid[i], NULL);
+    for (uint32_t i = 0; i < n; i++) {
+        pthread_mutex_destroy(&poolDq[i].lock);
+        memFree(MEM_POOL, poolDq[i].task);
+    }
+    memFree(MEM_POOL, poolDq);
+    memFree(MEM_POOL, poolTid);
+
+    pthread_mutex_lock(&poolLock);
+    poolDq = NULL;
+    poolTid = NULL;
+    __atomic_store_n(&poolN, 0, __ATOMIC_RELEASE);
+    poolQuit = 0;
+    poolFailed = 0;
+    pthread_mutex_unlock(&poolLock);
+}
+
+uint32_t poolThreads(void)
+{
+    uint32_t n = __atomic_load_n(&poolN, __ATOMIC_ACQUIRE);
+    if (n == 0 && poolStart())
+        n = __atomic_load_n(&poolN, __ATOMIC_ACQUIRE);
+    return n ? n : 1;
+}
+
+/* Append to the back of a deque, doubling it when full */
+static bool poolPush(poolDeque *d, const poolTask *t)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->tail - d->head == d->cap) {
+        poolTask *tmp = (poolTask *)memAlloc(MEM_POOL, sizeof(poolTask)
+                                             * d->cap * 2);
+        if (tmp == NULL) {
+            pthread_mutex_unlock(&d->lock);
+            log_msg_default;
+            return 0;
+        }
+        for (uint32_t i = 0; i < d->cap; i++)
+            tmp[i] = d->task[(d->head + i) & (d->cap - 1)];
+        memFree(MEM_POOL, d->task);
+        d->task = tmp;
+        d->head = 0;
+        d->tail = d->cap;
+        d->cap *= 2;
+    }
+    d->task[d->tail++ & (d->cap - 1)] = *t;
+    pthread_mutex_unlock(&d->lock);
+    return 1;
+}
+
+void poolSubmit(poolGroup *g, poolFn fn, void *arg)
+{
+    poolTask t = {fn, arg, g};
+    uint32_t n = __atomic_load_n(&poolN, __ATOMIC_ACQUIRE);
+    if (n == 0 && poolStart())
+        n = __atomic_load_n(&poolN, __ATOMIC_ACQUIRE);
+    if (n == 0) {
+        fn(arg);
+        return;
+    }
+
+    // workers keep their own tasks, the rest are dealt round robin
+    uint32_t i = poolSelf ? poolSelf - 1
+        : __atomic_fetch_add(&poolNext, 1, __ATOMIC_RELAXED) % n;
+    __atomic_add_fetch(&g->pending, 1, __ATOMIC_ACQ_REL);
+    if (!poolPush(&poolDq[i], &t)) {
+        __atomic_sub_fetch(&g->pending, 1, __ATOMIC_ACQ_REL);
+        fn(arg);
+        return;
+    }
+    pthread_mutex_lock(&poolLock);
+    poolQueued++;
+    pthread_cond_signal(&poolWork);
+    pthread_cond_broadcast(&poolDone); // waiters help too
+    pthread_mutex_unlock(&poolLock);
+}
+
+void poolWait(poolGroup *g)
+{
+    while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE)) {
+        poolTask t;
+        if (poolTake(&t)) {
+            poolRun(&t);
+            continue;
+        }
+        pthread_mutex_lock(&poolLock);
+        while (__atomic_load_n(&g->pending, __ATOMIC_ACQUIRE)
+               && poolQueued == 0)
+            pthread_cond_wait(&poolDone, &poolLock);
+        pthread_mutex_unlock(&poolLock);
+    }
+}
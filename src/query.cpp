@@ -0,0 +1,77 @@
+#include "query.h"
+#include "alib.h"
+
+uint64_t colsTotalSize(const blockCols *c)
+{
+    uint64_t sum = 0;
+    for (uint16_t i = 0; i < c->n; i++)
+        sum += c->xl[i];
+    return sum;
+}
+
+uint16_t colsLargest(const blockCols *c)
+{
+    uint16_t best = c->n;
+    uint64_t max = 0;
+    for (uint16_t i = 0; i < c->n; i++) {
+        if (best == c->n || c->xl[i] > max) {
+            max = c->xl[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+uint16_t colsFilterTracker(const blockCols *c, uint32_t tr, uint16_t *out)
+{
+    uint16_t found = 0;
+    // branch free so the loop only streams through c->tr
+    for (uint16_t i = 0; i < c->n; i++) {
+        out[found] = i;
+        found += c->tr[i] == tr;
+    }
+    return found;
+}
+
+uint64_t chainTotalSize(chain *ch)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0, n = chainSize(ch); i < n; i++) {
+        blockCols *c = blockColumns(chainBlock(ch, i));
+        if (c)
+            sum += colsTotalSize(c);
+    }
+    return sum;
+}
+
+bool chainLargest(chain *ch, uint32_t *blk, uint16_t *pk)
+{
+    bool found = 0;
+    uint64_t max = 0;
+    for (uint32_t i = 0, n = chainSize(ch); i < n; i++) {
+        blockCols *c = blockColumns(chainBlock(ch, i));
+        if (c == NULL || c->n == 0)
+            continue;
+        uint16_t j = colsLargest(c);
+        if (!found || c->xl[j] > max) {
+            max = c->xl[j];
+            *blk = i;
+            *pk = j;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+uint64_t chainCountTracker(chain *ch, uint32_t tr)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0, n = chainSize(ch); i < n; i++) {
+        blockCols *c = blockColumns(chainBlock(ch, i));
+        if (c == NULL)
+            continue;
+        for (uint16_t j = 0; j < c->n; j++)
+            count += c->tr[j] == tr;
+    }
+    return count;
+}
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "strtab.h"
+#include "arena.h"
+#include "log.h"
+
+/* FNV-1a, the strings are short so nothing fancier is needed */
+static uint32_t strHash(const char *str, uint32_t len)
+{
+    uint32_t h = 2166136261U;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (unsigned char)str[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/* Double the hash table and put every id back in */
+static bool strtabRehash(strtab *tab)
+{
+    uint32_t nSlot = tab->nSlot ? tab->nSlot * 2 : 64;
+    uint32_t *slot = (uint32_t *)memCalloc(MEM_STRING, nSlot, sizeof(uint32_t));
+    if (slot == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    for (uint32_t id = 0; id < tab->n; id++) {
+        uint32_t i = tab->ent[id].hash & (nSlot - 1);
+        while (slot[i] != 0)
+            i = (i + 1) & (nSlot - 1);
+        slot[i] = id + 1;
+    }
+    memFree(MEM_STRING, tab->slot);
+    tab->slot = slot;
+    tab->nSlot = nSlot;
+    return 1;
+}
+
+void strtabInit(strtab *tab)
+{
+    tab->ent = NULL;
+    tab->n = 0;
+    tab->cap = 0;
+    tab->slot = NULL;
+    tab->nSlot = 0;
+    tab->retired = NULL;
+    tab->nRetired = 0;
+    arenaInit(&tab->mem, MEM_STRING);
+    pthread_mutex_init(&tab->lock, NULL);
+}
+
+/* Move the entries to an array twice as big, the old one is retired
+ * since strtabGet may be reading it without the lock */
+static bool strtabGrow(strtab *tab)
+{
+    uint32_t cap = tab->cap ? tab->cap * 2 : 32;
+    strtabEntry *tmp = (strtabEntry *)memAlloc(MEM_STRING,
+                                               sizeof(strtabEntry) * cap);
+    strtabEntry **old = (strtabEntry **)memRealloc(MEM_STRING, tab->retired,
+                                                   sizeof(strtabEntry *)
+                                                   * (tab->nRetired + 1));
+    if (tmp == NULL || old == NULL) {
+        log_msg_default;
+        memFree(MEM_STRING, tmp);
+        if (old)
+            tab->retired = old;
+        return 0;
+    }
+    tab->retired = old;
+    if (tab->ent != NULL) {
+        memcpy(tmp, tab->ent, sizeof(strtabEntry) * tab->n);
+        tab->retired[tab->nRetired++] = tab->ent;
+    }
+    __atomic_store_n(&tab->ent, tmp, __ATOMIC_RELEASE);
+    tab->cap = cap;
+    return 1;
+}
+
+/* strtabIntern with tab->lock held */
+static uint32_t strtabInternLocked(strtab *tab, const char *str, uint32_t len)
+{
+    // keep the load factor under 1/2
+    if (tab->n * 2 >= tab->nSlot && !strtabRehash(tab))
+        return STRTAB_NONE;
+
+    uint32_t hash = strHash(str, len);
+    uint32_t i = hash & (tab->nSlot - 1);
+    for (; tab->slot[i] != 0; i = (i + 1) & (tab->nSlot - 1)) {
+        strtabEntry *e = &tab->ent[tab->slot[i] - 1];
+        if (e->hash == hash && e->len == len && !memcmp(e->str, str, len))
+            return tab->slot[i] - 1;
+    }
+
+    if (tab->n == tab->cap && !strtabGrow(tab))
+        return STRTAB_NONE;
+
+    char *copy = arenaStrndup(&tab->mem, str, len);
+    if (copy == NULL)
+        return STRTAB_NONE;
+    strtabEntry *e = &tab->ent[tab->n];
+    e->str = copy;
+    e->len = len;
+    e->hash = hash;
+    tab->slot[i] = tab->n + 1;
+    // the entry is filled in before readers can see the new id
+    __atomic_store_n(&tab->n, tab->n + 1, __ATOMIC_RELEASE);
+    return tab->n - 1;
+}
+
+uint32_t strtabIntern(strtab *tab, const char *str, uint32_t len)
+{
+    pthread_mutex_lock(&tab->lock);
+    uint32_t id = strtabInternLocked(tab, str, len);
+    pthread_mutex_unlock(&tab->lock);
+    return id;
+}
+
+uint32_t strtabFree(strtab *tab)
+{
+    uint32_t bytesFreed = sizeof(strtabEntry) * tab->cap
+        + sizeof(uint32_t) * tab->nSlot;
+    bytesFreed += arenaRelease(&tab->mem);
+    memFree(MEM_STRING, tab->ent);
+    memFree(MEM_STRING, tab->slot);
+    for (uint32_t i = 0; i < tab->nRetired; i++)
+        memFree(MEM_STRING, tab->retired[i]);
+    memFree(MEM_STRING, tab->retired);
+    pthread_mutex_destroy(&tab->lock);
+    strtabInit(tab);
+    return bytesFreed;
+}
@@ -0,0 +1,631 @@
+#include <stdlib.h>
+#include <string.h>
+#include <charconv>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXT_SCAN_X86
+#endif
+
+#include "textparse.h"
+#include "alib.h"
+#include "strtab.h"
+#include "infohash.h"
+#include "blockbuilder.h"
+#include "outbuf.h"
+#include "pool.h"
+#include "memstat.h"
+#include "log.h"
+
+/* Hand out the set bits of a 64 byte mask as offsets */
+static inline uint32_t scanBits(uint64_t m, uint32_t off, uint16_t *out,
+                                uint32_t n)
+{
+    while (m) {
+        out[n++] = (uint16_t)(off + __builtin_ctzll(m));
+        m &= m - 1;
+    }
+    return n;
+}
+
+uint32_t textScanLinesScalar(const char *p, uint32_t len, uint16_t *out)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < len; i++)
+        if (p[i] == '\n')
+            out[n++] = (uint16_t)i;
+    return n;
+}
+
+#ifdef TEXT_SCAN_X86
+/* The bytes after the last full 64, offsets counted from p */
+static inline uint32_t scanTail(const char *p, uint32_t i, uint32_t len,
+                                uint16_t *out)
+{
+    uint32_t n = 0;
+    for (; i < len; i++)
+        if (p[i] == '\n')
+            out[n++] = (uint16_t)i;
+    return n;
+}
+
+__attribute__((target("avx2")))
+static uint32_t scanAvx2(const char *p, uint32_t len, uint16_t *out)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    uint32_t i = 0, n = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, nl))
+            | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, nl))
+            << 32;
+        n = scanBits(m, i, out, n);
+    }
+    return n + scanTail(p, i, len, out + n);
+}
+
+__attribute__((target("sse2")))
+static uint32_t scanSse2(const char *p, uint32_t len, uint16_t *out)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    uint32_t i = 0, n = 0;
+    for (; i + 64 <= len; i += 64) {
+        uint64_t m = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl))
+                << (16 * k);
+        }
+        n = scanBits(m, i, out, n);
+    }
+    return n + scanTail(p, i, len, out + n);
+}
+#endif//TEXT_SCAN_X86
+
+static uint32_t (*scanImpl)(const char *, uint32_t, uint16_t *);
+static const char *scanName;
+static pthread_once_t scanOnce = PTHREAD_ONCE_INIT;
+
+static void scanInit(void)
+{
+    uint32_t (*impl)(const char *, uint32_t, uint16_t *) = textScanLinesScalar;
+    scanName = "scalar";
+#ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl = scanAvx2;
+        scanName = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        impl = scanSse2;
+        scanName = "sse2";
+    }
+#endif
+    __atomic_store_n(&scanImpl, impl, __ATOMIC_RELEASE);
+}
+
+uint32_t textScanLines(const char *p, uint32_t len, uint16_t *out)
+{
+    uint32_t (*impl)(const char *, uint32_t, uint16_t *)
+        = __atomic_load_n(&scanImpl, __ATOMIC_ACQUIRE);
+    if (impl == NULL) {
+        pthread_once(&scanOnce, scanInit);
+        impl = scanImpl;
+    }
+    return impl(p, len, out);
+}
+
+const char *textScanName(void)
+{
+    pthread_once(&scanOnce, scanInit);
+    return scanName;
+}
+
+void textCursorInit(textCursor *c, const char *data, size_t len)
+{
+    c->p = data;
+    c->end = data + len;
+    c->win = c->next = data;
+    c->nIdx = c->iIdx = 0;
+}
+
+/* Next line without its newline, 0 at the end of the data */
+static inline bool textLine(textCursor *c, std::string_view *line)
+{
+    if (c->p >= c->end)
+        return 0;
+    const char *s = c->p, *e = c->end;
+    // scan windows until one holds a newline or the data ends
+    while (c->iIdx == c->nIdx && c->next < c->end) {
+        uint32_t len = c->end - c->next < TEXT_WINDOW
+            ? c->end - c->next : TEXT_WINDOW;
+        c->win = c->next;
+        c->nIdx = textScanLines(c->win, len, c->idx);
+        c->iIdx = 0;
+        c->next += len;
+    }
+    if (c->iIdx < c->nIdx) {
+        e = c->win + c->idx[c->iIdx++];
+        c->p = e + 1;
+    } else {
+        c->p = c->end;
+    }
+    if (e > s && e[-1] == '\r')
+        e--;
+    *line = std::string_view(s, e - s);
+    return 1;
+}
+
+/* Value of a "Xname: value," line, the tag is padded to 5 chars */
+static inline bool textValue(std::string_view t, std::string_view *v)
+{
+    if (t.size() < 7 || t[5] != ':' || t[6] != ' ')
+        return 0;
+    t.remove_prefix(7);
+    if (!t.empty() && t.back() == ',')
+        t.remove_suffix(1);
+    *v = t;
+    return 1;
+}
+
+/* The whole value as a number, the writers print %d and %ld as signed,
+ * the cast back to unsigned is exact */
+static inline bool textInt(std::string_view v, int64_t *out)
+{
+    const char *end = v.data() + v.size();
+    std::from_chars_result r = std::from_chars(v.data(), end, *out);
+    return r.ec == std::errc() && r.ptr == end;
+}
+
+bool textDictLine(textDict *dict, std::string_view line, chain *ch)
+{
+    std::string_view v;
+    uint32_t id;
+    if (!textValue(line, &v))
+        return 0;
+    const char *end = v.data() + v.size();
+    std::from_chars_result r = std::from_chars(v.data(), end, id);
+    if (r.ec != std::errc() || r.ptr == end || *r.ptr != ' '
+        || id == STRTAB_NONE)
+        return 0;
+
+    if (id >= dict->n) {
+        // doubled, partHeadText writes the ids in order
+        uint32_t n = dict->n < id / 2 + 1 ? id + 1
+            : dict->n < STRTAB_NONE / 2 ? dict->n * 2 : STRTAB_NONE;
+        uint32_t *tmp = (uint32_t *)memRealloc(MEM_PARSER, dict->id,
+                                               sizeof(uint32_t) * (size_t)n);
+        if (tmp == NULL) {
+            log_msg_default;
+            return 0;
+        }
+        for (uint32_t i = dict->n; i < n; i++)
+            tmp[i] = STRTAB_NONE;
+        dict->id = tmp;
+        dict->n = n;
+    }
+    dict->id[id] = strtabIntern(&ch->trackers, r.ptr + 1, end - r.ptr - 1);
+    return 1;
+}
+
+/* A Ptr value, a dict id or a raw url from older files */
+static uint32_t textTracker(std::string_view v, const textDict *dict,
+                            chain *ch)
+{
+    uint32_t id;
+    const char *end = v.data() + v.size();
+    std::from_chars_result r = std::from_chars(v.data(), end, id);
+    if (r.ec == std::errc() && r.ptr == end)
+        return id < dict->n ? dict->id[id] : STRTAB_NONE;
+    return strtabIntern(&ch->trackers, v.data(), v.size());
+}
+
+/* Bytes BlockBuilder needs for the strings of a pack, btih topics are
+ * stored as digests */
+static inline uint32_t textStrBytes(const textPack *pk)
+{
+    uint32_t len = pk->dn.size() + 1;
+    bool btih = pk->xt.size() == XT_BTIH_MAX - 1 - 8
+        || pk->xt.size() == XT_BTIH_MAX - 1;
+    if (!btih || pk->xt.compare(0, XT_BTIH_PREFIX_LEN, XT_BTIH_PREFIX))
+        len += pk->xt.size() + 1;
+    return len;
+}
+
+block *text2BlockBuf(textCursor *c, const textDict *dict, chain *ch,
+                     textScratch *s)
+{
+    std::string_view line, v;
+    int64_t time = 0, crc = 0, n = 0, key = 0, val = 0;
+    uint32_t nPack = 0, strBytes = 0;
+    textPack *cur = NULL;
+    bool ok = 1;
+
+    while (ok && textLine(c, &line)) {
+        while (!line.empty() && line[0] == '\t')
+            line.remove_prefix(1);
+        if (line.size() < 2)
+            continue;
+
+        if (line[0] == 'P' && cur != NULL) {
+            switch (line[1]) {
+            case 'd': // pack->dn
+                ok = textValue(line, &cur->dn)
+                    && cur->dn.size() <= PACK_STR_MAX;
+                break;
+            case 'l': // pack->xl
+                ok = textValue(line, &v) && textInt(v, &val);
+                cur->xl = (uint64_t)val;
+                break;
+            case 'x': // pack->xt
+                ok = textValue(line, &cur->xt)
+                    && cur->xt.size() <= PACK_STR_MAX;
+                break;
+            case 't': // pack->tr
+                ok = textValue(line, &cur->tr);
+                break;
+            case '}': // end of pack
+                strBytes += textStrBytes(cur);
+                nPack++;
+                cur = NULL;
+                break;
+            default: // Pinfo is derived from the topic
+                break;
+            }
+        } else if (line[0] == '{' && line[1] == 'P') {
+            if (nPack == MAX_U16) {
+                log_msg_custom("nPack limit reached");
+                ok = 0;
+                break;
+            }
+            if (nPack == s->cap) {
+                uint32_t cap = s->cap ? s->cap * 2 : 128;
+                textPack *tmp = (textPack *)memRealloc(MEM_PARSER, s->pk,
+                                                       sizeof(textPack) * cap);
+                if (tmp == NULL) {
+                    log_msg_default;
+                    ok = 0;
+                    break;
+                }
+                s->pk = tmp;
+                s->cap = cap;
+            }
+            cur = &s->pk[nPack];
+            cur->dn = cur->xt = cur->tr = std::string_view();
+            cur->xl = 0;
+        } else if (line[0] == 'B') {
+            switch (line[1]) {
+            case 'g': // block->time
+                ok = textValue(line, &v) && textInt(v, &time);
+                break;
+            case 'c': // block->crc
+                ok = textValue(line, &v) && textInt(v, &crc);
+                break;
+            case 'n': // block->n
+                ok = textValue(line, &v) && textInt(v, &n);
+                break;
+            case 'k': // block->key
+                ok = textValue(line, &v) && textInt(v, &key);
+                break;
+            case '}': { // end of block
+                BlockBuilder bb((uint32_t)n, (uint64_t)key, nPack, strBytes);
+                if (!bb.ok()) {
+                    log_msg_default;
+                    return NULL;
+                }
+                bb.setTime((uint32_t)time);
+                bb.setCrc((uint32_t)crc);
+                for (uint32_t i = 0; i < nPack; i++) {
+                    textPack *pk = &s->pk[i];
+                    if (bb.add(pk->dn, pk->xl, pk->xt,
+                               textTracker(pk->tr, dict, ch)) == NULL) {
+                        log_msg_custom("Adding a text pack failed");
+                        return NULL;
+                    }
+                }
+                return bb.finish();
+            }
+            default: // Bpack is counted, trans are skipped
+                break;
+            }
+        }
+    }
+    log_msg_custom(ok ? "Text block truncated" : "Text block corrupt");
+    return NULL;
+}
+
+/* 1 if the line starts a block */
+static inline bool textIsBlock(std::string_view line)
+{
+    return line.size() >= 2 && line[0] == '{' && line[1] == 'B';
+}
+
+/* Read the Ctime/Csize/Cdict lines, @p c is left on the first {B line
+ *
+ * @return 0 if the part has no block
+ */
+static bool textHead(textCursor *c, textDict *dict, chain *ch)
+{
+    std::string_view line;
+    const char *start = c->p;
+    while (textLine(c, &line)) {
+        if (textIsBlock(line)) {
+            c->p = start;
+            return 1;
+        }
+        if (line.size() >= 2 && line[0] == 'C' && line[1] == 'd'
+            && !textDictLine(dict, line, ch))
+            log_msg_custom("Bad Cdict line skipped");
+        if (line == "EOF")
+            return 0;
+        start = c->p;
+    }
+    return 0;
+}
+
+/* Arguments of a range parsing thread */
+typedef struct
+{
+    const char     *start;  // a {B line, or end
+    const char     *end;    // the {B line of the next range, or the end
+    const textDict *dict;
+    chain          *ch;
+    block         **bx;     // blocks parsed, in order
+    uint32_t        n;
+    uint32_t        cap;
+    bool            ok;     // 0 if a block failed, bx holds the ones before
+    bool            stray;  // a Cdict showed up after the first block
+}textRange;
+
+static void *textRangeParse(void *args)
+{
+    textRange *r = (textRange *)args;
+    textScratch s = {NULL, 0};
+    std::string_view line;
+    // the cursor holds the line index, keep it off the caller's stack
+    textCursor *c = (textCursor *)memAlloc(MEM_PARSER, sizeof(textCursor));
+    r->ok = c != NULL;
+    if (c == NULL)
+        log_msg_default;
+    else
+        textCursorInit(c, r->start, r->end - r->start);
+
+    while (r->ok && textLine(c, &line)) {
+        if (textIsBlock(line)) {
+            if (r->n == r->cap) {
+                uint32_t cap = r->cap ? r->cap * 2 : 256;
+                block **tmp = (block **)memRealloc(MEM_PARSER, r->bx,
+                                                   sizeof(block *) * cap);
+                if (tmp == NULL) {
+                    log_msg_default;
+                    r->ok = 0;
+                    break;
+                }
+                r->bx = tmp;
+                r->cap = cap;
+            }
+            block *bx = text2BlockBuf(c, r->dict, r->ch, &s);
+            if (bx == NULL)
+                r->ok = 0;
+            else
+                r->bx[r->n++] = bx;
+        } else if (line.size() >= 2 && line[0] == 'C' && line[1] == 'd') {
+            r->stray = 1;
+        } else if (line == "EOF") {
+            break;
+        }
+    }
+    textParseFree(NULL, &s);
+    memFree(MEM_PARSER, c);
+    return NULL;
+}
+
+/* Start of the first {B line at or after p, end if there is none */
+static const char *textNextBlock(const char *p, const char *start,
+                                 const char *end)
+{
+    if (p > start && p[-1] == '\n' && end - p >= 2 && p[0] == '{'
+        && p[1] == 'B')
+        return p;
+    while (p < end) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (nl == NULL || end - nl < 3)
+            return end;
+        if (nl[1] == '{' && nl[2] == 'B')
+            return nl + 1;
+        p = nl + 1;
+    }
+    return end;
+}
+
+bool textBuf2Chain(const char *data, size_t len, chain *ch, uint8_t threads)
+{
+    textDict dict = {NULL, 0};
+    bool ok = ch != NULL;
+    if (!ok)
+        return 0;
+    if (threads == 0)
+        threads = 1;
+
+    textCursor *c = (textCursor *)memAlloc(MEM_PARSER, sizeof(textCursor));
+    if (c == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    textCursorInit(c, data, len);
+    if (!textHead(c, &dict, ch)) {
+        textParseFree(&dict, NULL);
+        memFree(MEM_PARSER, c);
+        return 1; // no block
+    }
+
+    // cut the blocks in byte ranges, each one moved to a block start
+    const char *body = c->p, *end = data + len;
+    memFree(MEM_PARSER, c);
+    textRange r[threads];
+    for (uint8_t i = 0; i < threads; i++) {
+        r[i].start = i == 0 ? body : r[i - 1].end;
+        r[i].end = i == threads - 1 ? end
+            : textNextBlock(body + (end - body) / threads * (i + 1), data, end);
+        if (r[i].end < r[i].start)
+            r[i].end = r[i].start;
+        r[i].dict = &dict;
+        r[i].ch = ch;
+        r[i].bx = NULL;
+        r[i].n = r[i].cap = 0;
+        r[i].ok = 1;
+        r[i].stray = 0;
+    }
+
+    // the calling thread takes the last range
+    poolGroup g;
+    poolGroupInit(&g);
+    for (uint8_t i = 0; i < threads - 1; i++)
+        poolSubmit(&g, textRangeParse, &r[i]);
+    textRangeParse(&r[threads - 1]);
+    poolWait(&g);
+
+    // concatenate in file order, up to the first range that failed
+    uint32_t total = 0, i, k, base;
+    for (i = 0; i < threads; i++) {
+        total += r[i].n;
+        if (!r[i].ok)
+            break;
+        if (r[i].stray)
+            log_msg_custom("Cdict after the first block ignored");
+    }
+    uint32_t last = i; // ranges after it are dropped
+    ok = last == threads;
+    base = total ? chainReserve(ch, total) : 0;
+    if (base == MAX_U32) {
+        log_msg_custom("Failed to reserve the blocks of a text part");
+        ok = 0;
+        last = 0;
+        total = 0;
+    }
+    uint32_t at = base;
+    for (i = 0; i < threads; i++) {
+        for (k = 0; k < r[i].n; k++) {
+            if (i <= last && total) {
+                chainPublish(ch, at++, r[i].bx[k]);
+                total--;
+            } else {
+                deleteBlock(r[i].bx[k]);
+            }
+        }
+        memFree(MEM_PARSER, r[i].bx);
+    }
+
+    textParseFree(&dict, NULL);
+    return ok;
+}
+
+bool textFile2Chain(FILE *fp, chain *ch, uint8_t threads)
+{
+    long len;
+    if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0
+        || fseek(fp, 0, SEEK_SET)) {
+        log_msg_default;
+        return 0;
+    }
+
+    char *data = (char *)memAlloc(MEM_IO, len ? len : 1);
+    if (data == NULL) {
+        log_msg_default;
+        return 0;
+    }
+    bool ok = fread(data, 1, len, fp) == (size_t)len
+        && textBuf2Chain(data, len, ch, threads);
+    memFree(MEM_IO, data);
+    return ok;
+}
+
+bool textStreamInit(textStream *ts)
+{
+    ts->dict.id = NULL;
+    ts->dict.n = 0;
+    ts->s.pk = NULL;
+    ts->s.cap = 0;
+    ts->eof = 0;
+    ts->c = (textCursor *)memAlloc(MEM_PARSER, sizeof(textCursor));
+    ts->ok = outBufInit(&ts->in, NULL) && ts->c;
+    if (ts->c == NULL)
+        log_msg_default;
+    return ts->ok;
+}
+
+/* Parse the lines of [in.buf, in.buf + len), which ends on a line */
+static bool textStreamRun(textStream *ts, uint32_t len, chain *ch)
+{
+    std::string_view line;
+    textCursorInit(ts->c, ts->in.buf, len);
+    while (!ts->eof && textLine(ts->c, &line)) {
+        if (textIsBlock(line)) {
+            block *bx = text2BlockBuf(ts->c, &ts->dict, ch, &ts->s);
+            if (bx && !insertBlock(bx, ch)) {
+                deleteBlock(bx);
+                bx = NULL;
+            }
+            if (bx == NULL)
+                return 0;
+        } else if (line.size() >= 2 && line[0] == 'C' && line[1] == 'd') {
+            if (!textDictLine(&ts->dict, line, ch))
+                log_msg_custom("Bad Cdict line skipped");
+        } else if (line == "EOF") {
+            ts->eof = 1;
+        }
+    }
+    return 1;
+}
+
+bool textStreamFeed(textStream *ts, const void *data, uint32_t len, chain *ch)
+{
+    if (!ts->ok || ts->eof)
+        return ts->ok;
+    uint32_t old = ts->in.len;
+    outBufWrite(&ts->in, data, len);
+    if (ts->in.err) {
+        ts->ok = 0;
+        return 0;
+    }
+
+    /* everything before the last {B line is whole blocks, the bytes
+     * kept from the last call hold none but the one at 0 */
+    const char *p = ts->in.buf;
+    uint32_t cut = ts->in.len, low = old > 2 ? old - 2 : 1;
+    while (cut > low && !(p[cut - 1] == '\n' && cut + 2 <= ts->in.len
+                          && p[cut] == '{' && p[cut + 1] == 'B'))
+        cut--;
+    if (cut <= low)
+        return 1;
+    ts->ok = textStreamRun(ts, cut, ch);
+    memmove(ts->in.buf, p + cut, ts->in.len - cut);
+    ts->in.len -= cut;
+    return ts->ok;
+}
+
+bool textStreamEnd(textStream *ts, chain *ch)
+{
+    bool ok = ts->ok && textStreamRun(ts, ts->in.len, ch);
+    outBufFree(&ts->in);
+    textParseFree(&ts->dict, &ts->s);
+    memFree(MEM_PARSER, ts->c);
+    ts->c = NULL;
+    ts->ok = 0;
+    return ok;
+}
+
+void textParseFree(textDict *dict, textScratch *s)
+{
+    if (dict) {
+        memFree(MEM_PARSER, dict->id);
+        dict->id = NULL;
+        dict->n = 0;
+    }
+    if (s) {
+        memFree(MEM_PARSER, s->pk);
+        s->pk = NULL;
+        s->cap = 0;
+    }
+}
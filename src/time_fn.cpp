@@ -1,6 +1,9 @@
 #include "time_fn.h"
 
 #include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 struct tm *get_loc_time()
 {
@@ -13,3 +16,28 @@ struct tm *get_loc_time()
     return loc_time;
 }
 
+
+uint32_t msNow(void)
+{
+#ifdef _WIN32
+    return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+uint64_t usNow(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (uint64_t)c.QuadPart * 1000000 / f.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}